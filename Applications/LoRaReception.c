@@ -3,22 +3,108 @@
 //***********************************************************************************************************************
 #include "LoRaReception.h"
 #include "sensorHandling.h"
+#include "linkAdaptation.h"
+#include "sampleLog.h"
+#include "timeSync.h"
+#include "relay.h"
+#include "firmwareUpdate.h"
+#include "authentication.h"
 #include "../Applications/mainApplication.h"
 #include "../Configuration/HardwareConfiguration.h"
 #include "../Peripherals/RTCC.h"
 #include "../Peripherals/LoRa.h"
+#include "../Peripherals/timers.h"
 #include <string.h>
 
 //***********************************************************************************************************************
-// Propriedades da aplicao pai que precisam ser acessadas neste mdulo
+// Propriedades da aplicação pai que precisam ser acessadas neste módulo
 //***********************************************************************************************************************
 extern controlConfig_t controlList[6];
 
 //***********************************************************************************************************************
-// Variveis privadas do mdulo
+// Variáveis privadas do módulo
 //***********************************************************************************************************************
 static uint8_t receptionState = 0, messageSize = 0, bytesReaded = 0;
 static unsigned char receptionBuffer[MAX_PACKET_SIZE];
+static uint8_t downlinkState = DOWNLINK_UNKNOWN, uplinkAwaitingAck = 0, uplinkAcknowledged = 0, uplinkRetries = 0;
+static uint32_t uplinkTick = 0, uplinkAckTimeOut = 0, creditTick = 0;
+static unsigned char telemetryFrame[TELEMETRY_FRAME_SIZE];
+static uint8_t relayDelivery = 0;               // Executando um quadro recebido por um relay
+static uint8_t authenticatedFrame = 0;          // Executando um quadro recebido em EXT_AUTH
+
+// Respostas a comandos com número de sequência, para que repetições do roteador não sejam executadas de novo
+#define REPLAY_UNCACHEABLE          0xFF        // A resposta não coube na entrada: o comando é executado de novo
+typedef struct
+{
+    uint8_t         valid;
+    uint8_t         source;
+    uint8_t         sequence;
+    uint8_t         size;                       // Quadro guardado: comando + payload
+    unsigned char   frame[REPLAY_RESPONSE_SIZE];
+} ReplayEntry_t;
+
+static ReplayEntry_t replayCache[REPLAY_CACHE_SIZE];
+static ReplayEntry_t *replyCapture = NULL;      // Entrada que recebe as respostas do comando em execução
+static uint8_t replayNext = 0;
+
+// Fila de transmissão. Sai primeiro a menor prioridade; na mesma prioridade, por ordem de chegada.
+#define TX_PRIORITY_ACK             0           // Confirmações simples
+#define TX_PRIORITY_REPLY           1           // Respostas a comandos
+#define TX_PRIORITY_UPLINK          2           // Amostras, resumos e requisições do módulo
+typedef struct
+{
+    uint8_t         priority;
+    uint8_t         headerMode;                 // EXPLICIT_MODE ou IMPLICIT_MODE
+    uint8_t         size;                       // Quadro: comando + payload
+    unsigned char   frame[MAX_PACKET_SIZE];
+} TxEntry_t;
+
+static TxEntry_t txQueue[TX_QUEUE_SIZE];
+static uint8_t txCount = 0;
+static LoRaModemConfig_t pendingModemConfig;    // Aplicada quando a fila esvaziar, depois da confirmação
+static uint8_t modemConfigPending = 0;
+
+// Descarga do log de amostras em andamento, continuada a cada passagem conforme há espaço na fila
+static struct
+{
+    uint8_t             active;
+    uint8_t             framesSent;
+    unsigned char       cmdPrefix;
+    SampleLogRequest_t  request;
+} logDump;
+
+// Lote de comandos com número de sequência em andamento
+static struct
+{
+    uint8_t         active;
+    unsigned char   cmdPrefix;
+    BatchAck_t      ack;
+} batch;
+
+// Resposta a um comando de grupo, aguardando a janela do endereço do módulo
+static struct
+{
+    uint8_t         pending;
+    unsigned char   cmdPrefix;
+    uint8_t         extCmd;
+    union
+    {
+        GroupReply_t    group;
+        OtaStatus_t     firmware;
+    } reply;
+    uint8_t         size;
+    uint32_t        start;
+    uint32_t        delay;
+} groupReply;
+
+// Atrás de um relay, a requisição de mensagens e as respostas vão dentro do envelope EXT_RELAY. As respostas estendidas
+// levam o código estendido antes do payload.
+typedef char relayedReplySizeCheck[((sizeof(uint32_t) + sizeof(LinkReport_t) + sizeof(uint16_t)) <= RELAY_INNER_PAYLOAD_SIZE &&
+                                    (1 + sizeof(SampleLogFrame_t)) <= RELAY_INNER_PAYLOAD_SIZE &&
+                                    (1 + (MAX_SENSORS * sizeof(CommandConfig_t))) <= RELAY_INNER_PAYLOAD_SIZE &&
+                                    (1 + sizeof(ReportConfig_t)) <= RELAY_INNER_PAYLOAD_SIZE &&
+                                    (1 + sizeof(OtaStatus_t)) <= RELAY_INNER_PAYLOAD_SIZE &&
+                                    (1 + sizeof(AuthInfo_t)) <= RELAY_INNER_PAYLOAD_SIZE) ? 1 : -1];
 
 //***********************************************************************************************************************
 // Macros
@@ -28,20 +114,779 @@ static unsigned char receptionBuffer[MAX_PACKET_SIZE];
                                                                                         ROUTER_COMMAND)
 
 //***********************************************************************************************************************
-// Funes privadas
+// Funções privadas
 //***********************************************************************************************************************
 //=======================================================================================================================
-// Funo de processamento dos pacotes recebidos.
+// Continua a descarga de uma faixa do log de amostras, em quadros de até SAMPLE_LOG_RECORDS_PER_FRAME registros enviados
+// em sequência. Cada passagem enfileira o que couber, deixando uma posição da fila para confirmações e respostas; o
+// restante segue na próxima passagem. A descarga para no primeiro registro indisponível ou quando acaba o crédito de
+// tempo no ar; o roteador pede o restante depois. Um quadro sem registros indica que nada pôde ser enviado.
+//=======================================================================================================================
+static void serviceSampleLog(void)
+{
+    SampleLogFrame_t frame;
+    uint8_t records;
+
+    while(logDump.request.count != 0 && isLowPriorityTrafficAllowed())
+    {
+        if(txCount >= (TX_QUEUE_SIZE - 1))
+            return;
+
+        frame.sequence = logDump.request.firstSequence;
+        for(records = 0; records < SAMPLE_LOG_RECORDS_PER_FRAME && records < logDump.request.count; records++)
+        {
+            if(!readLoggedSample(logDump.request.firstSequence + records, &frame.record[records]))
+                break;
+        }
+        if(records == 0)
+            break;
+
+        if(!sendExtendedPacket(logDump.cmdPrefix, EXT_GET_SAMPLE_LOG, (unsigned char *)&frame, sizeof(uint16_t) + (records * sizeof(PackedSample_t))))
+            return;
+        logDump.framesSent++;
+        logDump.request.firstSequence += records;
+        logDump.request.count -= records;
+    }
+
+    if(logDump.framesSent == 0 &&
+       !sendExtendedPacket(logDump.cmdPrefix, EXT_GET_SAMPLE_LOG, (unsigned char *)&logDump.request.firstSequence, sizeof(uint16_t)))
+        return;
+    logDump.active = 0;
+}
+
+//=======================================================================================================================
+// Indica se um quadro de resposta é apenas uma confirmação: [comando][ACK/NACK] ou [CMD_EXTENDED][sub][ACK/NACK].
+// Retorna PACKET_ACK, PACKET_NACK ou 0.
+//=======================================================================================================================
+static uint8_t getStatusReply(unsigned char *frame, uint8_t size)
+{
+    uint8_t status;
+
+    if(size < 2 || size > 3)
+        return 0;
+    status = frame[size - 1];
+    if(status != PACKET_ACK && status != PACKET_NACK)
+        return 0;
+    if(size == 3 && (frame[0] & COMMAND_MASK) != CMD_EXTENDED)
+        return 0;
+    return status;
+}
+
+//=======================================================================================================================
+// Envia a confirmação do lote em andamento e o encerra
+//=======================================================================================================================
+static void sendBatchAck(void)
+{
+    uint16_t received = batch.ack.received;
+
+    batch.ack.cumulative = batch.ack.first - 1;
+    while(received & 0x0001)
+    {
+        batch.ack.cumulative++;
+        received >>= 1;
+    }
+    sendExtendedPacket(batch.cmdPrefix, EXT_BATCH_ACK, (unsigned char *)&batch.ack, sizeof(BatchAck_t));
+    batch.active = 0;
+}
+
+//=======================================================================================================================
+// Prioridade de transmissão de um quadro do módulo
+//=======================================================================================================================
+static uint8_t getTxPriority(unsigned char cmd, unsigned char *payload, uint8_t payloadSize)
+{
+    unsigned char frame[3];
+
+    switch(cmd & COMMAND_MASK)
+    {
+        case CMD_REQUEST_ACTION:
+        case CMD_SEND_SAMPLES:
+        case CMD_SEND_PACKED_SAMPLES:
+        case CMD_SEND_SUMMARY:
+            return TX_PRIORITY_UPLINK;
+        case CMD_GET_DATETIME:
+            if(payloadSize == 0)                // Requisição de data/hora, sem payload
+                return TX_PRIORITY_UPLINK;
+            break;
+    }
+
+    if(payloadSize > 2)
+        return TX_PRIORITY_REPLY;
+    frame[0] = cmd;
+    memcpy(&frame[1], payload, payloadSize);
+    return (getStatusReply(frame, payloadSize + 1) != 0) ? TX_PRIORITY_ACK : TX_PRIORITY_REPLY;
+}
+
+//=======================================================================================================================
+// Acrescenta um quadro ao último da fila, formando [CMD_EXTENDED][EXT_BUNDLE] seguido de [tamanho][quadro] para cada
+// quadro agrupado. Retorna 0 se o resultado não couber em MAX_PACKET_SIZE.
+//=======================================================================================================================
+static uint8_t appendToBundle(TxEntry_t *entry, unsigned char cmd, unsigned char *payload, uint8_t payloadSize)
+{
+    uint8_t isBundle = ((entry->frame[0] & COMMAND_MASK) == CMD_EXTENDED && entry->frame[1] == EXT_BUNDLE);
+    uint8_t required = entry->size + 1 + 1 + payloadSize + (isBundle ? 0 : 3);
+
+    if(required > MAX_PACKET_SIZE)
+        return 0;
+
+    if(!isBundle)
+    {
+        memmove(&entry->frame[3], entry->frame, entry->size);
+        entry->frame[2] = entry->size;
+        entry->frame[0] = (entry->frame[3] & ~COMMAND_MASK) | CMD_EXTENDED;
+        entry->frame[1] = EXT_BUNDLE;
+        entry->size += 3;
+    }
+    entry->frame[entry->size++] = payloadSize + 1;
+    entry->frame[entry->size++] = cmd;
+    memcpy(&entry->frame[entry->size], payload, payloadSize);
+    entry->size += payloadSize;
+    return 1;
+}
+
+//=======================================================================================================================
+// Transmite o próximo quadro da fila, se o rádio estiver livre. Não espera o fim da transmissão.
+//=======================================================================================================================
+static void serviceTransmitQueue(void)
+{
+    TxEntry_t *entry;
+    uint8_t next = 0;
+
+    if(isLoRaTransmitting())
+        return;
+
+    if(txCount == 0)
+    {
+        // A nova configuração de modem só é aplicada depois que a confirmação saiu com a antiga. setLoRaModemConfig() põe
+        // o rádio em Standby e a recepção é retomada pela janela ou pela escuta contínua.
+        if(modemConfigPending)
+        {
+            setLoRaModemConfig(&pendingModemConfig);
+            modemConfigPending = 0;
+        }
+        return;
+    }
+
+    for(uint8_t index = 1; index < txCount; index++)
+    {
+        if(txQueue[index].priority < txQueue[next].priority)
+            next = index;
+    }
+
+    entry = &txQueue[next];
+    beginLoRaPacket(entry->headerMode);
+    if(entry->headerMode == EXPLICIT_MODE)
+    {
+        writeByteToLora(0xAA);
+        writeByteToLora(0x55);
+        writeByteToLora(entry->size);
+    }
+    loadBufferToLoRa(entry->frame, entry->size);
+    endLoRaPacket();
+    if(entry->headerMode == IMPLICIT_MODE)
+        uplinkTick = getTimerInterruptCount();      // A espera pela confirmação conta a partir do envio
+
+    txCount--;
+    memmove(entry, entry + 1, (txCount - next) * sizeof(TxEntry_t));
+}
+
+//=======================================================================================================================
+// Coloca um quadro na fila de transmissão. Respostas seguidas ao mesmo destino são agrupadas em um único quadro, o que
+// economiza o preâmbulo e o cabeçalho de cada uma. Uma amostra ainda na fila é substituída pela mais recente. Retorna 0
+// com a fila cheia, sem esperar: quem enviou tenta de novo em uma próxima passagem.
+//=======================================================================================================================
+static uint8_t enqueueFrame(uint8_t headerMode, unsigned char cmd, unsigned char *payload, uint8_t payloadSize)
+{
+    TxEntry_t *entry;
+    uint8_t priority = getTxPriority(cmd, payload, payloadSize);
+
+    if(payloadSize > (MAX_PACKET_SIZE - 1))
+        payloadSize = MAX_PACKET_SIZE - 1;
+
+    if(headerMode == IMPLICIT_MODE)
+    {
+        for(uint8_t index = 0; index < txCount; index++)
+        {
+            if(txQueue[index].headerMode == IMPLICIT_MODE && txQueue[index].frame[0] == cmd)
+            {
+                memcpy(&txQueue[index].frame[1], payload, payloadSize);
+                return 1;
+            }
+        }
+    }
+    else if(txCount > 0 && priority != TX_PRIORITY_UPLINK)
+    {
+        entry = &txQueue[txCount - 1];
+        if(entry->headerMode == EXPLICIT_MODE && entry->priority != TX_PRIORITY_UPLINK &&
+           (entry->frame[0] & ~(COMMAND_MASK | SOURCE_MASK)) == (cmd & ~(COMMAND_MASK | SOURCE_MASK)) &&
+           appendToBundle(entry, cmd, payload, payloadSize))
+        {
+            if(priority < entry->priority)
+                entry->priority = priority;
+            return 1;
+        }
+    }
+
+    if(txCount == TX_QUEUE_SIZE)
+        return 0;
+
+    entry = &txQueue[txCount++];
+    entry->headerMode = headerMode;
+    entry->frame[0] = cmd;
+    memcpy(&entry->frame[1], payload, payloadSize);
+    entry->size = payloadSize + 1;
+    entry->priority = priority;
+    return 1;
+}
+
+//=======================================================================================================================
+// Indica se o quadro é do próprio encaminhamento por relays (envelopes, anúncios e descoberta), trocado entre vizinhos
+//=======================================================================================================================
+static uint8_t isRelayLinkFrame(unsigned char cmd, unsigned char *payload, uint8_t payloadSize)
+{
+    if((cmd & COMMAND_MASK) != CMD_EXTENDED || payloadSize == 0)
+        return 0;
+    return(payload[0] == EXT_RELAY || payload[0] == EXT_RELAY_ADVERTISE || payload[0] == EXT_RELAY_DISCOVER);
+}
+
+//=======================================================================================================================
+// Coloca o quadro de telemetria guardado na fila. Retorna 0 com a fila cheia.
+//=======================================================================================================================
+static uint8_t transmitTelemetry(void)
+{
+    uint8_t queued;
+
+    // Atrás de um relay, a amostra segue como um quadro comum, dentro do envelope EXT_RELAY
+    if(isRelayedUplink())
+        queued = sendPacket(telemetryFrame[0], &telemetryFrame[1], TELEMETRY_FRAME_SIZE - 1);
+    else
+        queued = enqueueFrame(IMPLICIT_MODE, telemetryFrame[0], &telemetryFrame[1], TELEMETRY_FRAME_SIZE - 1);
+    if(queued)
+        uplinkTick = getTimerInterruptCount();
+    return queued;
+}
+
+//=======================================================================================================================
+// Aplica uma lista de configurações de canal, cada uma com o seu índice. Assim como CMD_SET_CONTROL_CONFIG, só é
+// gravado na EEPROM com CMD_SAVE_CONFIG. Retorna PACKET_NACK se a lista estiver vazia ou algum índice for inválido.
+//=======================================================================================================================
+static unsigned char applyControlConfigList(unsigned char *list, uint8_t size)
+{
+    CommandConfig_t config;
+    uint8_t count = size / sizeof(CommandConfig_t);
+    unsigned char response = (count > 0) ? PACKET_ACK : PACKET_NACK;
+
+    for(uint8_t index = 0; index < count; index++)
+    {
+        memcpy(&config, &list[index * sizeof(CommandConfig_t)], sizeof(CommandConfig_t));
+        if(config.index >= MAX_SENSORS)
+        {
+            response = PACKET_NACK;
+            continue;
+        }
+        controlList[config.index].operation = config.operation;
+        controlList[config.index].maxThreshold = config.maxThreshold;
+        controlList[config.index].minThreshold = config.minThreshold;
+    }
+    return response;
+}
+
+//=======================================================================================================================
+// Lê o cabeçalho de um comando de grupo e indica se o módulo é um dos destinatários
+//=======================================================================================================================
+static uint8_t acceptGroupCommand(unsigned char *packet, uint8_t size, GroupHeader_t *header)
+{
+    if(size < (2 + sizeof(GroupHeader_t)))
+        return 0;
+
+    memcpy(header, &packet[2], sizeof(GroupHeader_t));
+    return((header->groupMask & getGroupMembership()) != 0);
+}
+
+//=======================================================================================================================
+// Agenda a resposta a um comando de grupo para a janela do endereço do módulo. É enviada por taskLoRaReception().
+//=======================================================================================================================
+static void scheduleGroupReply(unsigned char cmdPrefix, uint8_t extCmd, GroupHeader_t *header, uint8_t result)
+{
+    groupReply.cmdPrefix = cmdPrefix;
+    groupReply.extCmd = extCmd;
+    groupReply.reply.group.sequence = header->sequence;
+    groupReply.reply.group.result = result;
+    groupReply.size = sizeof(GroupReply_t);
+    groupReply.start = getTimerInterruptCount();
+    groupReply.delay = (uint32_t)getNodeAddress() * header->replySlot * 10;
+    groupReply.pending = 1;
+}
+
+static void processReception(unsigned char *packet, uint8_t size);
+
+//=======================================================================================================================
+// Processamento de EXT_SEQUENCED. O comando interno é executado uma única vez por número de sequência e origem; as
+// repetições são respondidas com a resposta guardada. As confirmações simples entram na confirmação do lote.
+//=======================================================================================================================
+static void processSequencedReception(unsigned char *packet, uint8_t size)
+{
+    SequencedHeader_t header;
+    ReplayEntry_t *entry = NULL;
+    unsigned char *inner = &packet[2 + sizeof(SequencedHeader_t)];
+    uint8_t innerSize = size - 2 - sizeof(SequencedHeader_t);
+    uint8_t source = getPacketOrigin(packet[0]), offset, status = 0;
+
+    if(size < (3 + sizeof(SequencedHeader_t)))
+        return;
+    memcpy(&header, &packet[2], sizeof(SequencedHeader_t));
+
+    // Envelopes não são aninhados
+    if((inner[0] & COMMAND_MASK) == CMD_EXTENDED && innerSize > 1 && inner[1] == EXT_SEQUENCED)
+        return;
+
+    for(uint8_t index = 0; index < REPLAY_CACHE_SIZE; index++)
+    {
+        if(replayCache[index].valid && replayCache[index].source == source && replayCache[index].sequence == header.sequence)
+            entry = &replayCache[index];
+    }
+
+    // Cada lote cobre BATCH_ACK_WINDOW números de sequência a partir do primeiro comando recebido
+    if(batch.active && (uint8_t)(header.sequence - batch.ack.first) >= BATCH_ACK_WINDOW)
+        sendBatchAck();
+    if(!batch.active)
+    {
+        batch.active = 1;
+        batch.cmdPrefix = getCmdPrefixFromOrigin(packet[0]);
+        batch.ack.first = header.sequence;
+        batch.ack.received = 0;
+        batch.ack.failed = 0;
+    }
+    offset = header.sequence - batch.ack.first;
+
+    if(entry != NULL && entry->size != REPLAY_UNCACHEABLE)
+    {
+        // Repetição: responde com o que foi guardado, sem executar de novo
+        status = getStatusReply(entry->frame, entry->size);
+        if(status == 0 && entry->size > 0)
+            sendPacket(entry->frame[0], &entry->frame[1], entry->size - 1);
+    }
+    else
+    {
+        if(entry == NULL)
+        {
+            entry = &replayCache[replayNext];
+            replayNext = (replayNext + 1) % REPLAY_CACHE_SIZE;
+        }
+        entry->valid = 1;
+        entry->source = source;
+        entry->sequence = header.sequence;
+        entry->size = 0;
+
+        replyCapture = entry;
+        processReception(inner, innerSize);
+        replyCapture = NULL;
+
+        if(entry->size != REPLAY_UNCACHEABLE)
+            status = getStatusReply(entry->frame, entry->size);
+    }
+
+    batch.ack.received |= (1U << offset);
+    if(status == PACKET_NACK)
+        batch.ack.failed |= (1U << offset);
+
+    if(header.flags & SEQUENCED_FLAG_BATCH_END)
+        sendBatchAck();
+}
+
+//=======================================================================================================================
+// Processamento de EXT_RELAY. O quadro interno endereçado a este módulo é executado; os demais seguem para o próximo
+// salto, se o módulo for um relay.
+//=======================================================================================================================
+static void processRelayReception(unsigned char *packet, uint8_t size)
+{
+    RelayHeader_t header;
+    unsigned char *inner = &packet[2 + sizeof(RelayHeader_t)];
+    uint8_t innerSize = size - 2 - sizeof(RelayHeader_t);
+
+    if(size < (3 + sizeof(RelayHeader_t)))
+        return;
+    memcpy(&header, &packet[2], sizeof(RelayHeader_t));
+
+    switch(routeRelayFrame(&header))
+    {
+        case RELAY_DELIVER:
+            // Envelopes não são aninhados
+            if((inner[0] & COMMAND_MASK) == CMD_EXTENDED && innerSize > 1 && inner[1] == EXT_RELAY)
+                break;
+            relayDelivery = 1;
+            processReception(inner, innerSize);
+            relayDelivery = 0;
+            break;
+        case RELAY_FORWARD:
+            memcpy(&packet[2], &header, sizeof(RelayHeader_t));
+            sendExtendedPacket(packet[0] & ~(COMMAND_MASK | SOURCE_MASK), EXT_RELAY, &packet[2], size - 2);
+            break;
+        default:
+            break;
+    }
+}
+
+//=======================================================================================================================
+// Processamento de EXT_AUTH. O quadro interno só é executado se o MAC conferir e o contador for novo.
+//=======================================================================================================================
+static void processAuthenticatedReception(unsigned char *packet, uint8_t size)
+{
+    uint32_t counter;
+    unsigned char *inner = &packet[2 + sizeof(uint32_t)];
+    uint8_t innerSize = size - 2 - sizeof(uint32_t) - AUTH_TAG_SIZE;
+
+    if(size < (3 + sizeof(uint32_t) + AUTH_TAG_SIZE) || authenticatedFrame)
+        return;
+    memcpy(&counter, &packet[2], sizeof(uint32_t));
+
+    if(verifyAuthenticatedFrame(counter, inner, innerSize, &packet[size - AUTH_TAG_SIZE]))
+    {
+        authenticatedFrame = 1;
+        processReception(inner, innerSize);
+        authenticatedFrame = 0;
+    }
+}
+
+//=======================================================================================================================
+// Comandos aceitos sem autenticação mesmo com ela habilitada: o próprio EXT_AUTH, os envelopes cujo conteúdo passa de
+// novo por esta verificação e o anúncio de relay, que só altera a escolha do pai. O beacon de horário é difundido a
+// toda a rede e não pode usar a chave de cada módulo; o que ele pode alterar sem autenticação é limitado no seu
+// tratamento. Os bits de origem do comando não são considerados, porque qualquer transmissor pode preenchê-los.
+//=======================================================================================================================
+static uint8_t isOpenCommand(unsigned char *packet, uint8_t size)
+{
+    switch(packet[0] & COMMAND_MASK)
+    {
+        case CMD_TIME_BEACON:
+            return 1;
+        case CMD_EXTENDED:
+            if(size < 2)
+                return 0;
+            switch(packet[1])
+            {
+                case EXT_AUTH:
+                case EXT_RELAY:
+                case EXT_BUNDLE:
+                case EXT_RELAY_ADVERTISE:
+                    return 1;
+            }
+            break;
+    }
+    return 0;
+}
+
+//=======================================================================================================================
+// Processamento dos comandos estendidos. packet[1] identifica o comando.
+//=======================================================================================================================
+static void processExtendedReception(unsigned char *packet, uint8_t size)
+{
+    unsigned char cmdPrefix = getCmdPrefixFromOrigin(packet[0]);
+    unsigned char response = PACKET_NACK;
+    LoRaModemConfig_t modemConfig;
+    LinkAdaptCommand_t linkAdapt;
+    ReportConfig_t reportConfig;
+    SampleLogInfo_t logInfo;
+    IrrigationCalendar_t calendar;
+    GroupHeader_t groupHeader;
+    CommandConfig_t controlTable[MAX_SENSORS];
+    uint16_t groups;
+    UplinkSlot_t slot;
+    RelayConfig_t relayConfig;
+    OtaBegin_t otaBegin;
+    OtaBlockHeader_t otaBlock;
+    AuthInfo_t authInfo;
+
+    switch(packet[1])
+    {
+        case EXT_GET_MODEM_CONFIG:
+            sendExtendedPacket(cmdPrefix, EXT_GET_MODEM_CONFIG, (unsigned char *)getModemConfiguration(), sizeof(LoRaModemConfig_t));
+            break;
+        case EXT_SET_MODEM_CONFIG:
+            // A confirmação segue ainda com a configuração antiga, e só então a nova é aplicada. Se o roteador não
+            // for ouvido com a nova configuração, o módulo volta sozinho para a anterior.
+            if(size >= (2 + sizeof(LoRaModemConfig_t)))
+            {
+                memcpy(&modemConfig, &packet[2], sizeof(LoRaModemConfig_t));
+                if(setModemConfiguration(&modemConfig))
+                    response = PACKET_ACK;
+            }
+            sendExtendedPacket(cmdPrefix, EXT_SET_MODEM_CONFIG, &response, 1);
+            if(response == PACKET_ACK)
+            {
+                pendingModemConfig = modemConfig;
+                modemConfigPending = 1;
+            }
+            break;
+        case EXT_SET_NODE_ADDRESS:
+            if(size >= (2 + sizeof(uint8_t)))
+            {
+                setNodeAddress(packet[2]);
+                response = PACKET_ACK;
+            }
+            sendExtendedPacket(cmdPrefix, EXT_SET_NODE_ADDRESS, &response, 1);
+            break;
+        case EXT_LINK_ADAPT:
+            // Apenas SF e potência mudam. Passa pelo mesmo período de teste de uma nova configuração de modem.
+            // O comando pode ser difundido: um quadro curto não tem destino conhecido e fica sem resposta
+            if(size < (2 + sizeof(LinkAdaptCommand_t)))
+                break;
+            memcpy(&linkAdapt, &packet[2], sizeof(LinkAdaptCommand_t));
+            if(linkAdapt.nodeAddress != getNodeAddress() && linkAdapt.nodeAddress != BROADCAST_ADDRESS)
+                break;
+            modemConfig = *getModemConfiguration();
+            modemConfig.spreadingFactor = linkAdapt.spreadingFactor;
+            modemConfig.txPower = linkAdapt.txPower;
+            if(setModemConfiguration(&modemConfig))
+                response = PACKET_ACK;
+            sendExtendedPacket(cmdPrefix, EXT_LINK_ADAPT, &response, 1);
+            if(response == PACKET_ACK)
+            {
+                pendingModemConfig = modemConfig;
+                modemConfigPending = 1;
+            }
+            break;
+        case EXT_GET_REPORT_CONFIG:
+            for(uint8_t index = 0; index < MAX_SENSORS; index++)
+                reportConfig.deadband[index] = controlList[index].deadband;
+            reportConfig.heartbeatMinutes = getHeartbeatInterval();
+            reportConfig.summaryMinutes = getSummaryInterval();
+            reportConfig.sampleMinutes = getSampleInterval();
+            sendExtendedPacket(cmdPrefix, EXT_GET_REPORT_CONFIG, (unsigned char *)&reportConfig, sizeof(ReportConfig_t));
+            break;
+        case EXT_SET_REPORT_CONFIG:
+            // Assim como CMD_SET_CONTROL_CONFIG, só é gravado na EEPROM com CMD_SAVE_CONFIG
+            if(size >= (2 + sizeof(ReportConfig_t)))
+            {
+                memcpy(&reportConfig, &packet[2], sizeof(ReportConfig_t));
+                for(uint8_t index = 0; index < MAX_SENSORS; index++)
+                    controlList[index].deadband = reportConfig.deadband[index];
+                setHeartbeatInterval(reportConfig.heartbeatMinutes);
+                setSummaryInterval(reportConfig.summaryMinutes);
+                setSampleInterval(reportConfig.sampleMinutes);
+                response = PACKET_ACK;
+            }
+            sendExtendedPacket(cmdPrefix, EXT_SET_REPORT_CONFIG, &response, 1);
+            break;
+        case EXT_GET_RAW_SAMPLE:
+            // A resposta é o próprio quadro de amostra, com uma leitura feita agora
+            sendRawSample();
+            break;
+        case EXT_GET_SAMPLE_LOG_INFO:
+            getSampleLogInfo(&logInfo);
+            sendExtendedPacket(cmdPrefix, EXT_GET_SAMPLE_LOG_INFO, (unsigned char *)&logInfo, sizeof(SampleLogInfo_t));
+            break;
+        case EXT_GET_SAMPLE_LOG:
+            if(size < (2 + sizeof(SampleLogRequest_t)))
+                break;
+            // Um novo pedido substitui a descarga em andamento
+            memcpy(&logDump.request, &packet[2], sizeof(SampleLogRequest_t));
+            logDump.cmdPrefix = cmdPrefix;
+            logDump.framesSent = 0;
+            logDump.active = 1;
+            serviceSampleLog();
+            break;
+        case EXT_GET_IRRIGATION_CALENDAR:
+            calendar.index = packet[2];
+            if(size < (2 + sizeof(uint8_t)) || calendar.index >= MAX_SENSORS)
+            {
+                sendExtendedPacket(cmdPrefix, EXT_GET_IRRIGATION_CALENDAR, &response, 1);
+                break;
+            }
+            calendar.reserved = 0;
+            calendar.window = controlList[calendar.index].window;
+            calendar.blackout = controlList[calendar.index].blackout;
+            sendExtendedPacket(cmdPrefix, EXT_GET_IRRIGATION_CALENDAR, (unsigned char *)&calendar, sizeof(IrrigationCalendar_t));
+            break;
+        case EXT_SET_IRRIGATION_CALENDAR:
+            // Assim como CMD_SET_CONTROL_CONFIG, só é gravado na EEPROM com CMD_SAVE_CONFIG
+            if(size >= (2 + sizeof(IrrigationCalendar_t)))
+            {
+                memcpy(&calendar, &packet[2], sizeof(IrrigationCalendar_t));
+                if(calendar.index < MAX_SENSORS &&
+                   calendar.window.start <= 1440 && calendar.window.end <= 1440 &&
+                   calendar.blackout.start <= 1440 && calendar.blackout.end <= 1440)
+                {
+                    controlList[calendar.index].window = calendar.window;
+                    controlList[calendar.index].blackout = calendar.blackout;
+                    response = PACKET_ACK;
+                }
+            }
+            sendExtendedPacket(cmdPrefix, EXT_SET_IRRIGATION_CALENDAR, &response, 1);
+            break;
+        case EXT_GET_GROUPS:
+            groups = getGroupMembership();
+            sendExtendedPacket(cmdPrefix, EXT_GET_GROUPS, (unsigned char *)&groups, sizeof(uint16_t));
+            break;
+        case EXT_SET_GROUPS:
+            if(size >= (2 + sizeof(uint16_t)))
+            {
+                memcpy(&groups, &packet[2], sizeof(uint16_t));
+                setGroupMembership(groups);
+                response = PACKET_ACK;
+            }
+            sendExtendedPacket(cmdPrefix, EXT_SET_GROUPS, &response, 1);
+            break;
+        case EXT_GROUP_SET_CONTROL_CONFIG:
+            // Após o cabeçalho, uma ou mais configurações de canal
+            if(!acceptGroupCommand(packet, size, &groupHeader))
+                break;
+            response = applyControlConfigList(&packet[2 + sizeof(GroupHeader_t)], size - 2 - sizeof(GroupHeader_t));
+            scheduleGroupReply(cmdPrefix, EXT_GROUP_SET_CONTROL_CONFIG, &groupHeader, response);
+            break;
+        case EXT_GROUP_SAVE_CONFIG:
+            if(!acceptGroupCommand(packet, size, &groupHeader))
+                break;
+            response = saveConfiguration() ? PACKET_ACK : PACKET_NACK;
+            scheduleGroupReply(cmdPrefix, EXT_GROUP_SAVE_CONFIG, &groupHeader, response);
+            break;
+        case EXT_GET_CONTROL_TABLE:
+            // A tabela inteira em um só quadro, no lugar de um CMD_GET_CONTROL_CONFIG por canal
+            for(uint8_t index = 0; index < MAX_SENSORS; index++)
+            {
+                controlTable[index].index = index;
+                controlTable[index].operation = controlList[index].operation;
+                controlTable[index].minThreshold = controlList[index].minThreshold;
+                controlTable[index].maxThreshold = controlList[index].maxThreshold;
+            }
+            sendExtendedPacket(cmdPrefix, EXT_GET_CONTROL_TABLE, (unsigned char *)controlTable, sizeof(controlTable));
+            break;
+        case EXT_SET_CONTROL_TABLE:
+            response = applyControlConfigList(&packet[2], size - 2);
+            sendExtendedPacket(cmdPrefix, EXT_SET_CONTROL_TABLE, &response, 1);
+            break;
+        case EXT_GET_UPLINK_SLOT:
+            sendExtendedPacket(cmdPrefix, EXT_GET_UPLINK_SLOT, (unsigned char *)getUplinkSlot(), sizeof(UplinkSlot_t));
+            break;
+        case EXT_SET_UPLINK_SLOT:
+            // Permite ao roteador reorganizar as janelas quando módulos entram ou saem da rede
+            if(size >= (2 + sizeof(UplinkSlot_t)))
+            {
+                memcpy(&slot, &packet[2], sizeof(UplinkSlot_t));
+                setUplinkSlot(&slot);
+                response = PACKET_ACK;
+            }
+            sendExtendedPacket(cmdPrefix, EXT_SET_UPLINK_SLOT, &response, 1);
+            break;
+        case EXT_SEQUENCED:
+            processSequencedReception(packet, size);
+            break;
+        case EXT_RELAY:
+            processRelayReception(packet, size);
+            break;
+        case EXT_BUNDLE:
+            // Quadros agrupados pela fila de transmissão de outro módulo. Só os envelopes EXT_RELAY interessam.
+            for(uint8_t offset = 2; (offset + 1) < size && (offset + 1 + packet[offset]) <= size; offset += 1 + packet[offset])
+            {
+                if(packet[offset] > 2 && (packet[offset + 1] & COMMAND_MASK) == CMD_EXTENDED && packet[offset + 2] == EXT_RELAY)
+                    processRelayReception(&packet[offset + 1], packet[offset]);
+            }
+            break;
+        case EXT_RELAY_ADVERTISE:
+            if(size >= (2 + sizeof(RelayAdvertise_t)))
+                notifyRelayCandidate(((RelayAdvertise_t *)&packet[2])->address, ((RelayAdvertise_t *)&packet[2])->hops);
+            break;
+        case EXT_RELAY_DISCOVER:
+            requestRelayAdvertise();
+            break;
+        case EXT_GET_RELAY_CONFIG:
+            sendExtendedPacket(cmdPrefix, EXT_GET_RELAY_CONFIG, (unsigned char *)getRelayConfig(), sizeof(RelayConfig_t));
+            break;
+        case EXT_SET_RELAY_CONFIG:
+            // Papel e pai. O pai definido aqui é só o ponto de partida: a escolha automática pode trocá-lo.
+            relayConfig = *getRelayConfig();
+            if(size >= 4 && packet[2] <= RELAY_ROLE_RELAY && packet[3] != getNodeAddress())
+            {
+                relayConfig.role = packet[2];
+                relayConfig.parent = packet[3];
+                relayConfig.hops = (packet[3] == RELAY_ROUTER_ADDRESS) ? 1 : 2;
+                relayConfig.parentScore = RELAY_SCORE_NONE;
+                saveRelayConfig(&relayConfig);
+                response = PACKET_ACK;
+            }
+            sendExtendedPacket(cmdPrefix, EXT_SET_RELAY_CONFIG, &response, 1);
+            break;
+        case EXT_AUTH:
+            processAuthenticatedReception(packet, size);
+            break;
+        case EXT_SET_AUTH_KEY:
+            // A primeira chave só é aceita logo após um Power-on Reset, o que exige acesso ao módulo. Depois disso, a
+            // troca tem de vir autenticada com a chave atual, o que é garantido pela verificação em processReception().
+            if(size >= (2 + AUTH_KEY_SIZE) && (isAuthenticationEnabled() || isAuthenticationProvisioningAllowed()))
+            {
+                setAuthenticationKey(&packet[2]);
+                response = PACKET_ACK;
+            }
+            sendExtendedPacket(cmdPrefix, EXT_SET_AUTH_KEY, &response, 1);
+            break;
+        case EXT_GET_AUTH_INFO:
+            // Inclui o custo medido da verificação de EXT_AUTH e do resumo do patch
+            getAuthenticationInfo(&authInfo);
+            sendExtendedPacket(cmdPrefix, EXT_GET_AUTH_INFO, (unsigned char *)&authInfo, sizeof(AuthInfo_t));
+            break;
+        case EXT_OTA_BEGIN:
+            // Sem resposta: cada módulo informa a sua situação quando o roteador pede, com EXT_OTA_STATUS. Sem
+            // autenticação não há chave para o resumo do patch, e a atualização não começa.
+            if(isAuthenticationEnabled() && acceptGroupCommand(packet, size, &groupHeader) &&
+               size >= (2 + sizeof(GroupHeader_t) + sizeof(OtaBegin_t)))
+            {
+                memcpy(&otaBegin, &packet[2 + sizeof(GroupHeader_t)], sizeof(OtaBegin_t));
+                beginFirmwareUpdate(&otaBegin);
+            }
+            break;
+        case EXT_OTA_BLOCK:
+            if(size > (2 + sizeof(OtaBlockHeader_t)))
+            {
+                memcpy(&otaBlock, &packet[2], sizeof(OtaBlockHeader_t));
+                storeFirmwareBlock(otaBlock.updateId, otaBlock.index, &packet[2 + sizeof(OtaBlockHeader_t)], size - 2 - sizeof(OtaBlockHeader_t));
+            }
+            break;
+        case EXT_OTA_STATUS:
+        case EXT_OTA_COMMIT:
+            // Resposta na janela do endereço do módulo, com os blocos que faltam. No commit, o estado informa se o
+            // patch foi aceito.
+            if(acceptGroupCommand(packet, size, &groupHeader) && size >= (2 + sizeof(GroupHeader_t) + sizeof(uint16_t)))
+            {
+                if(packet[1] == EXT_OTA_COMMIT)
+                    commitFirmwareUpdate(packet[2 + sizeof(GroupHeader_t)] | ((uint16_t)packet[3 + sizeof(GroupHeader_t)] << 8));
+                scheduleGroupReply(cmdPrefix, packet[1], &groupHeader, 0);
+                getFirmwareUpdateStatus(&groupReply.reply.firmware);
+                groupReply.size = sizeof(OtaStatus_t);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+//=======================================================================================================================
+// Função de processamento dos pacotes recebidos.
 //=======================================================================================================================
 static void processReception(unsigned char *packet, uint8_t size)
 {
     DateTime_t tempDateTime;
     CommandConfig_t requestedConfig, *configToSet;
+    UplinkAck_t uplinkAck;
+    UplinkSlot_t slot;
+    uint32_t epoch;
+    uint8_t address;
+
+    // Com a autenticação habilitada, os comandos só são aceitos dentro de EXT_AUTH, a não ser os que não podem ser
+    // autenticados por módulo.
+    if(isAuthenticationEnabled() && !authenticatedFrame && !isOpenCommand(packet, size))
+        return;
     
+    // Ouvir o roteador confirma uma configuração de modem em teste e guarda a qualidade do enlace. Deve ser feito
+    // antes de tratar o comando, para que uma nova configuração recebida neste pacote não seja confirmada por ele mesmo.
+    if(getPacketOrigin(packet[0]) != COMMAND_SOURCE_MODULE)
+        notifyRouterReception();
+    // O roteador ouvido diretamente concorre com os relays na escolha do pai
+    if(getPacketOrigin(packet[0]) == COMMAND_SOURCE_ROUTER && !relayDelivery)
+        notifyRelayCandidate(RELAY_ROUTER_ADDRESS, 0);
+
     switch(packet[0] & COMMAND_MASK)
     {
         case CMD_MESSAGE:
-            if(getPacketOrigin(packet[0]) == COMMAND_SOURCE_SOFTWARE)
+            if(getPacketOrigin(packet[0]) == COMMAND_SOURCE_SOFTWARE && isLowPriorityTrafficAllowed())
                 sendPacket(ENDPOINT_COMMAND | CMD_MESSAGE, &packet[1], size-1);
             break;
         case CMD_GET_DATETIME:
@@ -49,16 +894,57 @@ static void processReception(unsigned char *packet, uint8_t size)
             sendPacket(getCmdPrefixFromOrigin(packet[0]) | CMD_GET_DATETIME, ((unsigned char *)&tempDateTime), sizeof(tempDateTime));
             break;
         case CMD_SET_DATETIME:
+            // Mantém o formato DateTime_t do software de configuração
+            if(size < (1 + sizeof(DateTime_t)))
+                break;
             memcpy(&tempDateTime, &packet[1], sizeof(DateTime_t));
-            writeDateTime((DateTime_t *)&packet[1]);
-            // Confirmao para o software de configurao. Para o roteador, o mdulo far nova requisio se falhar.
+            epoch = dateTimeToEpoch(&tempDateTime);
+            applyTimeSync(epoch);
+            // A resposta do roteador pode trazer também a janela de transmissão do módulo
+            if(size >= (1 + sizeof(DateTime_t) + sizeof(UplinkSlot_t)))
+            {
+                memcpy(&slot, &packet[1 + sizeof(DateTime_t)], sizeof(UplinkSlot_t));
+                setUplinkSlot(&slot);
+            }
+            // Confirmação para o software de configuração. Para o roteador, o módulo fará nova requisição se falhar.
             if(getPacketOrigin(packet[0]) == COMMAND_SOURCE_SOFTWARE)
                 sendAck(ENDPOINT_COMMAND | CMD_SET_DATETIME);
             
-            // RTCC foi atualizado e pode perder uma amostragem, j que o alarme est configurado para 0 segundos.
-            if(tempDateTime.Time.seconds < 10)
+            // RTCC foi atualizado e pode perder uma amostragem, já que o alarme está configurado para 0 segundos.
+            if(epochSecondOfMinute(epoch) < 10)
                 forceTaskSetup();
             break;
+        case CMD_TIME_BEACON:
+            // Difundido pelo roteador para toda a rede, sem resposta
+            if(size < (1 + sizeof(uint32_t)))
+                break;
+            memcpy(&epoch, &packet[1], sizeof(uint32_t));
+            // Com a autenticação habilitada, um beacon fora de EXT_AUTH só faz pequenas correções, limitadas até o
+            // próximo sincronismo autenticado. O primeiro horário tem de chegar por CMD_SET_DATETIME autenticado.
+            if(!isAuthenticationEnabled() || authenticatedFrame)
+                applyTimeSync(epoch);
+            else if(!applyOpenTimeSync(epoch))
+                break;
+            if(epochSecondOfMinute(epoch) < 10)
+                forceTaskSetup();
+
+            // Opcionalmente, um mapa de bits dos endereços com mensagens à espera no roteador. Não autenticado, pode ser
+            // forjado para calar o módulo, e é ignorado.
+            address = getNodeAddress();
+            if((!isAuthenticationEnabled() || authenticatedFrame) && size >= (1 + sizeof(uint32_t) + 1 + (address / 8)))
+                downlinkState = (packet[1 + sizeof(uint32_t) + (address / 8)] & (1 << (address % 8))) ? DOWNLINK_PENDING : DOWNLINK_NONE;
+            break;
+        case CMD_UPLINK_ACK:
+            if(size < (1 + sizeof(UplinkAck_t)))
+                break;
+            memcpy(&uplinkAck, &packet[1], sizeof(UplinkAck_t));
+            if(uplinkAck.nodeAddress != getNodeAddress())
+                break;
+            downlinkState = (uplinkAck.flags & UPLINK_FLAG_DOWNLINK_PENDING) ? DOWNLINK_PENDING : DOWNLINK_NONE;
+            uplinkAwaitingAck = 0;
+            uplinkAcknowledged = 1;
+            uplinkRetries = 0;
+            break;
         case CMD_GET_CONTROL_CONFIG:
             requestedConfig.index = packet[1];
             requestedConfig.operation = controlList[packet[1]].operation;
@@ -80,7 +966,7 @@ static void processReception(unsigned char *packet, uint8_t size)
                 sendNack(getCmdPrefixFromOrigin(packet[0]) | CMD_SAVE_CONFIG);
             break;
         case CMD_POWER_DOWN:
-            // Confirmao apenas para o software exibir para o usurio
+            // Confirmação apenas para o software exibir para o usuário
             if(getPacketOrigin(packet[0]) == COMMAND_SOURCE_SOFTWARE)
                 sendAck(ENDPOINT_COMMAND | CMD_POWER_DOWN);
             setTimeOutState(FORCE_TIMEOUT);
@@ -88,15 +974,19 @@ static void processReception(unsigned char *packet, uint8_t size)
         case CMD_SET_TIMEOUT:
             setTimeOutState(packet[1]);
             sendAck(getCmdPrefixFromOrigin(packet[0]) | CMD_SET_TIMEOUT);   // Confirma para software de controle
+            break;
+        case CMD_EXTENDED:
+            processExtendedReception(packet, size);
+            break;
         default:
             break;
     }
     
-    resetTimeOut();        // Qualquer pacote recebido reseta o timeout da aplicao.
+    resetTimeOut();        // Qualquer pacote recebido reseta o timeout da aplicação.
 }
 
 //=======================================================================================================================
-// Mquina de estados para controle e identificao de pacotes
+// Máquina de estados para controle e identificação de pacotes
 //=======================================================================================================================
 static void processCharReception(unsigned char data)
 {
@@ -134,29 +1024,58 @@ static void processCharReception(unsigned char data)
 }
 
 //***********************************************************************************************************************
-// Funes pblicas
+// Funções públicas
 //***********************************************************************************************************************
 //=======================================================================================================================
-// Monitoramento de recepo LoRa
+// Monitoramento de recepção LoRa
 //=======================================================================================================================
 void taskLoRaReception(uint8_t *requestCalendar, uint8_t *requestMessages)
 {
-    while(isLoRaTransmitting());   // Aguarda quaisquer transmisses pendentes.
+    // O crédito de tempo no ar é reposto a cada segundo acordado, e no Deep Sleep pelo tempo dormindo. Sem isto, um
+    // módulo mantido acordado pelas válvulas só gastaria crédito.
+    if((getTimerInterruptCount() - creditTick) >= 1000)
+    {
+        creditLoRaAirtime(1);
+        creditTick += 1000;
+    }
+
+    serviceTransmitQueue();
     
     // Faz pedido de mensagens ao servidor. Se houver mensagens, o servidor
-    // far vrias requisies, por isto a requisio  feita antes do tratamento
+    // fará várias requisições, por isto a requisição é feita antes do tratamento
     // de mensagens. No final, o servidor pede para entrar em modo Deep Sleep, ou o
-    // timeout far isto.
+    // timeout fará isto.
     if(*requestCalendar)
     {
-        sendDateTimeRequest();
-        *requestCalendar = 0;
+        if(sendDateTimeRequest())
+            *requestCalendar = 0;
     }
     else if(*requestMessages)
     {
-        sendMessageRequest();
-        resetTimeOut();
-        *requestMessages = 0;
+        // Depois de uma amostra, a confirmação do roteador diz se há mensagens à espera, e a requisição aguarda por
+        // ela, inclusive pelas retransmissões. Sem confirmação, segue como antes.
+        if(uplinkAwaitingAck)
+            resetTimeOut();
+        else
+        {
+            // Com pouco crédito de tempo no ar, ou se o roteador já disse não ter mensagens, a requisição não é
+            // feita. Sem ela o roteador não tem o que responder, então o módulo pode voltar a dormir imediatamente.
+            if(downlinkState != DOWNLINK_NONE && isLowPriorityTrafficAllowed())
+            {
+                // Uma nova requisição reabre a conversa, mesmo depois de um CMD_POWER_DOWN com válvulas ligadas
+                if(getTimeOutState() == FORCE_TIMEOUT)
+                    setTimeOutState(TIME_OUT_ENABLED);
+                if(sendMessageRequest())
+                    *requestMessages = 0;           // Com a fila cheia, a requisição fica para a próxima passagem
+                resetTimeOut();
+            }
+            else
+            {
+                if(getTimeOutState() != TIME_OUT_DISABLED)
+                    setTimeOutState(FORCE_TIMEOUT); // Uma sessão do software de configuração continua aberta
+                *requestMessages = 0;
+            }
+        }
     }
     
     if(checkLoRaReception())
@@ -164,25 +1083,159 @@ void taskLoRaReception(uint8_t *requestCalendar, uint8_t *requestMessages)
         while(LoRaBytesAvailable())
             processCharReception(readByteFromLoRa());
     }
+
+    // Amostra sem confirmação: retransmite com espera dobrada a cada tentativa, e deslocada pelo endereço do nó para
+    // que módulos que colidiram não colidam de novo. O roteador descarta repetições pelo instante da amostra.
+    if(uplinkAwaitingAck && (getTimerInterruptCount() - uplinkTick) >= uplinkAckTimeOut)
+    {
+        if(uplinkRetries < UPLINK_MAX_RETRIES && isLowPriorityTrafficAllowed())
+        {
+            // Com a fila cheia, a retransmissão fica para a próxima passagem
+            if(transmitTelemetry())
+            {
+                uplinkRetries++;
+                uplinkAckTimeOut = (uplinkAckTimeOut * 2) + ((getNodeAddress() % 8) * UPLINK_BACKOFF_JITTER_MS);
+            }
+        }
+        else
+            uplinkAwaitingAck = 0;
+    }
+
+    // A janela de recepção após a última transmissão terminou sem nada do roteador. Sem nada mais a enviar, o módulo
+    // pode dormir sem esperar o timeout. Com o timeout desabilitado pelo software de configuração, ou na janela de
+    // escuta programada, continua ouvindo.
+    if(getLoRaReceiveWindowState() == LORA_RX_WINDOW_CLOSED)
+    {
+        if(getTimeOutState() == TIME_OUT_DISABLED || isRelayListening() || isFirmwareUpdateActive() || isMulticastListening())
+            resumeLoRaListening();
+        else if(!groupReply.pending && !uplinkAwaitingAck && txCount == 0 && !*requestMessages && !*requestCalendar &&
+                !logDump.active && !isSensorHandlingBusy())
+            setTimeOutState(FORCE_TIMEOUT);
+    }
+
+    // Resposta a comando de grupo, na janela do endereço do módulo. Até lá, o módulo se mantém acordado.
+    if(groupReply.pending)
+    {
+        if((getTimerInterruptCount() - groupReply.start) >= groupReply.delay &&
+           sendExtendedPacket(groupReply.cmdPrefix, groupReply.extCmd, (unsigned char *)&groupReply.reply, groupReply.size))
+            groupReply.pending = 0;
+        resetTimeOut();
+    }
+
+    if(logDump.active)
+    {
+        serviceSampleLog();
+        resetTimeOut();
+    }
+
+    // Respostas geradas nesta passagem saem sem esperar a próxima
+    serviceTransmitQueue();
+}
+
+//=======================================================================================================================
+// Indica se há crédito de tempo no ar para tráfego de baixa prioridade (amostras, requisições e ecos de mensagens).
+// Abaixo da reserva, o crédito restante fica para ACKs e respostas a comandos.
+//=======================================================================================================================
+uint8_t isLowPriorityTrafficAllowed(void)
+{
+    return(getLoRaAirtimeCredit() > AIRTIME_LOW_PRIORITY_RESERVE_MS);
+}
+
+//=======================================================================================================================
+// Posições livres na fila de transmissão
+//=======================================================================================================================
+uint8_t getTransmitQueueSpace(void)
+{
+    return(TX_QUEUE_SIZE - txCount);
+}
+
+//=======================================================================================================================
+// Indica se o roteador confirmou, com CMD_UPLINK_ACK, o último quadro de telemetria enviado
+//=======================================================================================================================
+uint8_t isUplinkAcknowledged(void)
+{
+    return uplinkAcknowledged;
+}
+
+//=======================================================================================================================
+// Envia um pacote LoRa. Retorna 0 se a fila de transmissão estiver cheia.
+//=======================================================================================================================
+uint8_t sendPacket(unsigned char cmd, unsigned char *payload, uint8_t payloadSize)
+{
+    unsigned char envelope[MAX_PACKET_SIZE];
+    RelayHeader_t header;
+
+    // Define que todo comando enviado é de origem do módulo
+    cmd &= ~SOURCE_MASK;
+    cmd |= COMMAND_SOURCE_MODULE;
+
+    // Resposta a um comando com número de sequência: é guardada para as repetições. Confirmações simples não são
+    // transmitidas, pois vão na confirmação do lote.
+    if(replyCapture != NULL)
+    {
+        if(replyCapture->size == 0 && (payloadSize + 1) <= REPLAY_RESPONSE_SIZE)
+        {
+            replyCapture->frame[0] = cmd;
+            memcpy(&replyCapture->frame[1], payload, payloadSize);
+            replyCapture->size = payloadSize + 1;
+            if(getStatusReply(replyCapture->frame, replyCapture->size) != 0)
+                return 1;
+        }
+        else
+            replyCapture->size = REPLAY_UNCACHEABLE;
+    }
+
+    // Atrás de um relay, todo quadro do módulo segue ao roteador dentro do envelope EXT_RELAY, qualquer que seja o
+    // prefixo: amostras e resumos são difundidos, mas só o pai os encaminha. Ficam de fora os quadros do próprio
+    // encaminhamento, que se dirigem aos vizinhos. Um quadro que não cabe no envelope não é enviado.
+    if(isRelayedUplink() && !isRelayLinkFrame(cmd, payload, payloadSize))
+    {
+        if(payloadSize > RELAY_INNER_PAYLOAD_SIZE)
+            return 0;
+        envelope[0] = EXT_RELAY;
+        buildRelayHeader(&header);
+        memcpy(&envelope[1], &header, sizeof(RelayHeader_t));
+        envelope[1 + sizeof(RelayHeader_t)] = cmd;
+        memcpy(&envelope[2 + sizeof(RelayHeader_t)], payload, payloadSize);
+        return enqueueFrame(EXPLICIT_MODE, ROUTER_COMMAND | COMMAND_SOURCE_MODULE | CMD_EXTENDED, envelope, payloadSize + 2 + sizeof(RelayHeader_t));
+    }
+
+    return enqueueFrame(EXPLICIT_MODE, cmd, payload, payloadSize);
 }
 
 //=======================================================================================================================
-// Envia um pacote LoRa
+// Envia um quadro de telemetria de tamanho fixo, com cabeçalho implícito. O tamanho é pré-acordado com o roteador,
+// então o cabeçalho físico e os bytes 0xAA 0x55 e tamanho são omitidos. Comandos de tamanho variável continuam
+// usando sendPacket(), com cabeçalho explícito. Retorna 0 se a fila de transmissão estiver cheia.
 //=======================================================================================================================
-void sendPacket(unsigned char cmd, unsigned char *payload, uint8_t payloadSize)
+uint8_t sendTelemetryPacket(unsigned char cmd, unsigned char *payload)
 {
-    // Define que todo comando enviado  de origem do mdulo
+    uint8_t ackSize;
+
+    // Define que todo comando enviado é de origem do módulo
     cmd &= ~SOURCE_MASK;
     cmd |= COMMAND_SOURCE_MODULE;
 
-    while(isLoRaTransmitting());
-    beginLoRaPacket(EXPLICIT_MODE);
-    writeByteToLora(0xAA);
-    writeByteToLora(0x55);
-    writeByteToLora(payloadSize+1);
-    writeByteToLora(cmd);
-    loadBufferToLoRa(payload, payloadSize);
-    endLoRaPacket();
+    // O quadro é guardado para as retransmissões
+    telemetryFrame[0] = cmd;
+    memcpy(&telemetryFrame[1], payload, TELEMETRY_FRAME_SIZE - 1);
+    if(!transmitTelemetry())
+        return 0;
+
+    // O roteador confirma com CMD_UPLINK_ACK logo após receber a amostra. Com a autenticação habilitada, a confirmação
+    // vem dentro de EXT_AUTH.
+    ackSize = 3 + 1 + sizeof(UplinkAck_t);
+    if(isAuthenticationEnabled())
+        ackSize += 2 + sizeof(uint32_t) + AUTH_TAG_SIZE;
+    uplinkAckTimeOut = ((getLoRaTimeOnAir(TELEMETRY_FRAME_SIZE) + getLoRaTimeOnAir(ackSize)) / 1000) + UPLINK_ACK_GUARD_MS;
+    // Atrás de um relay, cada salto acrescenta um encaminhamento na ida e outro na volta
+    if(isRelayedUplink())
+        uplinkAckTimeOut += (uint32_t)getRelayConfig()->hops * 2 * RELAY_HOP_DELAY_MS;
+    uplinkAwaitingAck = 1;
+    uplinkAcknowledged = 0;
+    uplinkRetries = 0;
+    notifyReplyExpected();
+    return 1;
 }
 
 //=======================================================================================================================
@@ -190,18 +1243,9 @@ void sendPacket(unsigned char cmd, unsigned char *payload, uint8_t payloadSize)
 //=======================================================================================================================
 void sendAck(unsigned char cmd)
 {
-    // Define que todo comando enviado  de origem do mdulo
-    cmd &= ~SOURCE_MASK;
-    cmd |= COMMAND_SOURCE_MODULE;
+    unsigned char response = PACKET_ACK;
 
-    while(isLoRaTransmitting());
-    beginLoRaPacket(EXPLICIT_MODE);
-    writeByteToLora(0xAA);
-    writeByteToLora(0x55);
-    writeByteToLora(0x02);
-    writeByteToLora(cmd);
-    writeByteToLora(0x06);
-    endLoRaPacket();
+    sendPacket(cmd, &response, 1);
 }
 
 //=======================================================================================================================
@@ -209,43 +1253,76 @@ void sendAck(unsigned char cmd)
 //=======================================================================================================================
 void sendNack(unsigned char cmd)
 {
-    // Define que todo comando enviado  de origem do mdulo
-    cmd &= ~SOURCE_MASK;
-    cmd |= COMMAND_SOURCE_MODULE;
-    
-    while(isLoRaTransmitting());
-    beginLoRaPacket(EXPLICIT_MODE);
-    writeByteToLora(0xAA);
-    writeByteToLora(0x55);
-    writeByteToLora(0x02);
-    writeByteToLora(cmd);
-    writeByteToLora(0x15);
-    endLoRaPacket();
+    unsigned char response = PACKET_NACK;
+
+    sendPacket(cmd, &response, 1);
 }
 
 //=======================================================================================================================
-// Envia uma requisio de mensagens ao servidor
+// Envia um pacote de comando estendido. Retorna 0 se a fila de transmissão estiver cheia.
 //=======================================================================================================================
-void sendMessageRequest(void)
+uint8_t sendExtendedPacket(unsigned char cmdPrefix, uint8_t extCmd, unsigned char *payload, uint8_t payloadSize)
 {
-    DateTime_t tempDateTime;
+    unsigned char buffer[MAX_PACKET_SIZE];
+
+    if(payloadSize > (MAX_PACKET_SIZE - 2))
+        payloadSize = MAX_PACKET_SIZE - 2;
+
+    buffer[0] = extCmd;
+    memcpy(&buffer[1], payload, payloadSize);
+    return sendPacket(cmdPrefix | CMD_EXTENDED, buffer, payloadSize + 1);
+}
+
+//=======================================================================================================================
+// Envia uma requisição de mensagens ao servidor. Retorna 0 se a fila de transmissão estiver cheia.
+//=======================================================================================================================
+uint8_t sendMessageRequest(void)
+{
+    struct
+    {
+        uint32_t        timestamp;      // Segundos desde 01/01/1970
+        LinkReport_t    link;
+        uint16_t        configHash;     // Se igual ao do estado desejado, o roteador não precisa sincronizar nada
+    } request;
     
-    readDateTime(&tempDateTime);
-    sendPacket(ROUTER_COMMAND | COMMAND_SOURCE_MODULE | CMD_REQUEST_ACTION, ((unsigned char *)&tempDateTime), sizeof(tempDateTime));
+    request.timestamp = readEpoch();
+    getLinkReport(&request.link);
+    request.configHash = getConfigurationHash();
+    if(!sendPacket(ROUTER_COMMAND | COMMAND_SOURCE_MODULE | CMD_REQUEST_ACTION, ((unsigned char *)&request), sizeof(request)))
+        return 0;
+    notifyReplyExpected();
+    return 1;
 }
 
 //=======================================================================================================================
-// Envia uma requisio de data/hora ao servidor
+// Envia uma requisição de data/hora ao servidor. Retorna 0 se a fila de transmissão estiver cheia.
 //=======================================================================================================================
-void sendDateTimeRequest(void)
+uint8_t sendDateTimeRequest(void)
 {
-    while(isLoRaTransmitting());
-    beginLoRaPacket(EXPLICIT_MODE);
-    writeByteToLora(0xAA);
-    writeByteToLora(0x55);
-    writeByteToLora(0x01);
-    writeByteToLora(ROUTER_COMMAND | COMMAND_SOURCE_MODULE | CMD_GET_DATETIME);
-    endLoRaPacket();
+    if(!sendPacket(ROUTER_COMMAND | COMMAND_SOURCE_MODULE | CMD_GET_DATETIME, NULL, 0))
+        return 0;
+    notifyReplyExpected();
+    return 1;
+}
+
+//=======================================================================================================================
+// Transmite todos os quadros da fila e aguarda o fim da última transmissão. Usada antes de desligar o rádio. Um lote
+// ainda aberto recebe antes a sua confirmação final, que se perderia no Deep Sleep.
+//=======================================================================================================================
+void flushTransmitQueue(void)
+{
+    if(batch.active)
+    {
+        while(txCount == TX_QUEUE_SIZE)
+            serviceTransmitQueue();
+        sendBatchAck();
+    }
+
+    do
+    {
+        serviceTransmitQueue();
+    } while(txCount != 0 || isLoRaTransmitting());
+    serviceTransmitQueue();
 }
 
 //***********************************************************************************************************************
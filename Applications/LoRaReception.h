@@ -5,9 +5,11 @@
 #define	APPLICATION_LORA_RECEPTION
 
 #include <xc.h>
+#include "../Configuration/HardwareConfiguration.h"
+#include "sensorHandling.h"
 
 //=======================================================================================================================
-// Mscaras de comandos
+// Máscaras de comandos
 //=======================================================================================================================
 #define BROAD_COMMAND            0xC0
 #define ENDPOINT_COMMAND         0x80
@@ -19,7 +21,7 @@
 #define SOURCE_MASK              0x30
 
 //=======================================================================================================================
-// Comandos do mdulo
+// Comandos do módulo
 //=======================================================================================================================
 #define CMD_MESSAGE              0x00
 #define CMD_GET_DATETIME         0x01
@@ -31,12 +33,80 @@
 #define CMD_POWER_DOWN           0x07
 #define CMD_REQUEST_ACTION       0x08
 #define CMD_SET_TIMEOUT          0x09
+#define CMD_SEND_PACKED_SAMPLES  0x0A
+#define CMD_SEND_SUMMARY         0x0B
+#define CMD_TIME_BEACON          0x0C
+#define CMD_UPLINK_ACK           0x0D
+#define CMD_EXTENDED             0x0F
+
+//=======================================================================================================================
+// Comandos estendidos. O primeiro byte do payload de CMD_EXTENDED identifica o comando.
+//=======================================================================================================================
+#define EXT_GET_MODEM_CONFIG     0x00
+#define EXT_SET_MODEM_CONFIG     0x01
+#define EXT_SET_NODE_ADDRESS     0x02
+#define EXT_LINK_ADAPT           0x03
+#define EXT_GET_REPORT_CONFIG    0x04
+#define EXT_SET_REPORT_CONFIG    0x05
+#define EXT_GET_RAW_SAMPLE       0x06
+#define EXT_GET_SAMPLE_LOG_INFO  0x07
+#define EXT_GET_SAMPLE_LOG       0x08
+#define EXT_GET_IRRIGATION_CALENDAR 0x09
+#define EXT_SET_IRRIGATION_CALENDAR 0x0A
+#define EXT_GET_GROUPS           0x0B
+#define EXT_SET_GROUPS           0x0C
+#define EXT_GROUP_SET_CONTROL_CONFIG 0x0D
+#define EXT_GROUP_SAVE_CONFIG    0x0E
+#define EXT_GET_CONTROL_TABLE    0x0F
+#define EXT_SET_CONTROL_TABLE    0x10
+#define EXT_GET_UPLINK_SLOT      0x11
+#define EXT_SET_UPLINK_SLOT      0x12
+#define EXT_SEQUENCED            0x13
+#define EXT_BATCH_ACK            0x14
+#define EXT_BUNDLE               0x15
+#define EXT_RELAY                0x16
+#define EXT_RELAY_ADVERTISE      0x17
+#define EXT_RELAY_DISCOVER       0x18
+#define EXT_GET_RELAY_CONFIG     0x19
+#define EXT_SET_RELAY_CONFIG     0x1A
+#define EXT_OTA_BEGIN            0x1B
+#define EXT_OTA_BLOCK            0x1C
+#define EXT_OTA_STATUS           0x1D
+#define EXT_OTA_COMMIT           0x1E
+#define EXT_AUTH                 0x1F
+#define EXT_SET_AUTH_KEY         0x20
+#define EXT_GET_AUTH_INFO        0x21
+
+//=======================================================================================================================
+// Endereços
+//=======================================================================================================================
+#define BROADCAST_ADDRESS        0xFF
+
+//=======================================================================================================================
+// Respostas
+//=======================================================================================================================
+#define PACKET_ACK               0x06
+#define PACKET_NACK              0x15
+
+//=======================================================================================================================
+// Indicação de mensagens pendentes no roteador
+//=======================================================================================================================
+#define UPLINK_FLAG_DOWNLINK_PENDING 0x01
+#define DOWNLINK_UNKNOWN         0
+#define DOWNLINK_NONE            1
+#define DOWNLINK_PENDING         2
+
+//=======================================================================================================================
+// Entrega confiável
+//=======================================================================================================================
+#define SEQUENCED_FLAG_BATCH_END 0x01     // Último comando do lote: o módulo envia a confirmação do lote
+#define BATCH_ACK_WINDOW         16       // Comandos cobertos por uma confirmação de lote
 
 //***********************************************************************************************************************
-// Tipos de variveis relacionadas ao mdulo de recepo e transmisso LoRa
+// Tipos de variáveis relacionadas ao módulo de recepção e transmissão LoRa
 //***********************************************************************************************************************
 //=======================================================================================================================
-// Varivel de parmetros para o controle
+// Variável de parâmetros para o controle
 //=======================================================================================================================
 typedef struct
 {
@@ -46,15 +116,104 @@ typedef struct
     uint16_t        maxThreshold;
 } CommandConfig_t;
 
+//=======================================================================================================================
+// Parâmetros do envio de amostras por exceção
+//=======================================================================================================================
+typedef struct
+{
+    uint16_t        deadband[MAX_SENSORS];
+    uint16_t        heartbeatMinutes;
+    uint16_t        summaryMinutes;
+    uint16_t        sampleMinutes;
+} ReportConfig_t;
+
+//=======================================================================================================================
+// Calendário de irrigação de um canal. No pedido de leitura, só o índice é enviado.
+//=======================================================================================================================
+typedef struct
+{
+    uint8_t             index;
+    uint8_t             reserved;
+    IrrigationWindow_t  window;
+    IrrigationWindow_t  blackout;
+} IrrigationCalendar_t;
+
+//=======================================================================================================================
+// Confirmação de uma amostra pelo roteador, indicando se há mensagens à espera do módulo
+//=======================================================================================================================
+typedef struct
+{
+    uint8_t         nodeAddress;
+    uint8_t         flags;              // UPLINK_FLAG_DOWNLINK_PENDING
+} UplinkAck_t;
+
+//=======================================================================================================================
+// Cabeçalho de EXT_SEQUENCED. Depois dele vem um comando comum (byte de comando + payload), executado uma única vez
+// por número de sequência. Repetições são respondidas com a resposta guardada.
+//=======================================================================================================================
+typedef struct
+{
+    uint8_t         sequence;
+    uint8_t         flags;              // SEQUENCED_FLAG_xxx
+} SequencedHeader_t;
+
+//=======================================================================================================================
+// Confirmação de um lote de comandos com número de sequência. Confirmações simples (ACK/NACK) dos comandos do lote
+// não são enviadas uma a uma: ficam nos mapas de bits. Respostas com dados são enviadas normalmente.
+//=======================================================================================================================
+typedef struct
+{
+    uint8_t         first;              // Número de sequência do bit 0 dos mapas
+    uint8_t         cumulative;         // Último número de sequência recebido sem lacunas a partir de first
+    uint16_t        received;           // Bit n: comando first + n recebido
+    uint16_t        failed;             // Bit n: comando first + n respondido com PACKET_NACK
+} BatchAck_t;
+
+//=======================================================================================================================
+// Cabeçalho dos comandos de grupo, difundidos com BROAD_COMMAND. Cada membro responde depois de
+// (endereço do nó * replySlot) dezenas de milissegundos, para que as respostas não colidam.
+//=======================================================================================================================
+typedef struct
+{
+    uint16_t        groupMask;          // Grupos destinatários. O módulo aceita se pertencer a algum deles.
+    uint8_t         sequence;           // Identifica o comando nas respostas
+    uint8_t         replySlot;          // Duração da janela de resposta de cada endereço, em unidades de 10ms
+} GroupHeader_t;
+
+//=======================================================================================================================
+// Resposta de um membro a um comando de grupo
+//=======================================================================================================================
+typedef struct
+{
+    uint8_t         sequence;
+    uint8_t         result;             // PACKET_ACK ou PACKET_NACK
+} GroupReply_t;
+
+//=======================================================================================================================
+// Comando de adaptação do enlace, enviado pelo roteador a partir dos relatórios de qualidade
+//=======================================================================================================================
+typedef struct
+{
+    uint8_t         nodeAddress;
+    uint8_t         spreadingFactor;
+    int8_t          txPower;
+} LinkAdaptCommand_t;
+
 //***********************************************************************************************************************
-// Funes pblicas do mdulo
+// Funções públicas do módulo
 //***********************************************************************************************************************
 extern void taskLoRaReception(uint8_t *requestCalendar, uint8_t *requestMessages);
-extern void sendPacket(unsigned char cmd, unsigned char *payload, uint8_t payloadSize);
+extern uint8_t isLowPriorityTrafficAllowed(void);
+extern uint8_t isUplinkAcknowledged(void);
+extern uint8_t getTransmitQueueSpace(void);
+extern uint8_t sendPacket(unsigned char cmd, unsigned char *payload, uint8_t payloadSize);
+extern uint8_t sendTelemetryPacket(unsigned char cmd, unsigned char *payload);
 extern void sendAck(unsigned char cmd);
 extern void sendNack(unsigned char cmd);
-extern void sendMessageRequest(void);
-extern void sendDateTimeRequest(void);
+extern uint8_t sendExtendedPacket(unsigned char cmdPrefix, uint8_t extCmd, unsigned char *payload, uint8_t payloadSize);
+extern uint8_t sendMessageRequest(void);
+extern uint8_t sendDateTimeRequest(void);
+extern void flushTransmitQueue(void);
 
 #endif
 //***********************************************************************************************************************
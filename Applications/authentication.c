@@ -0,0 +1,257 @@
+//***********************************************************************************************************************
+//                                         Authentication
+//***********************************************************************************************************************
+#include "authentication.h"
+#include "mainApplication.h"
+#include "../Configuration/HardwareConfiguration.h"
+#include "../Peripherals/EEPROM.h"
+#include "../Peripherals/timers.h"
+#include <xc.h>
+
+//***********************************************************************************************************************
+// Variáveis privadas do módulo
+//***********************************************************************************************************************
+// Estado do SipHash. Os quadros são curtos, e o cálculo é feito byte a byte, sem copiar a mensagem.
+typedef struct
+{
+    uint64_t        v[4];
+    uint64_t        block;
+    uint8_t         length;
+} SipHash_t;
+
+static uint8_t authenticationEnabled = 0, provisioningWindow = 0;
+static uint32_t provisioningStart = 0;
+
+// Resumo em andamento e custos medidos, para EXT_GET_AUTH_INFO
+static SipHash_t digest;
+static uint32_t digestStart = 0;
+static AuthInfo_t costs = {0};
+
+//***********************************************************************************************************************
+// Macros
+//***********************************************************************************************************************
+#define rotateLeft(x, b)            (((x) << (b)) | ((x) >> (64 - (b))))
+
+//***********************************************************************************************************************
+// Funções privadas
+//***********************************************************************************************************************
+//=======================================================================================================================
+// Rodadas do SipHash
+//=======================================================================================================================
+static void sipRounds(SipHash_t *state, uint8_t rounds)
+{
+    uint64_t *v = state->v;
+
+    while(rounds--)
+    {
+        v[0] += v[1]; v[1] = rotateLeft(v[1], 13); v[1] ^= v[0]; v[0] = rotateLeft(v[0], 32);
+        v[2] += v[3]; v[3] = rotateLeft(v[3], 16); v[3] ^= v[2];
+        v[0] += v[3]; v[3] = rotateLeft(v[3], 21); v[3] ^= v[0];
+        v[2] += v[1]; v[1] = rotateLeft(v[1], 17); v[1] ^= v[2]; v[2] = rotateLeft(v[2], 32);
+    }
+}
+
+//=======================================================================================================================
+// Inicia o SipHash com a chave. k0 e k1 são lidos em little-endian, como na especificação.
+//=======================================================================================================================
+static void sipInit(SipHash_t *state, uint8_t *key)
+{
+    uint64_t k[2] = {0, 0};
+
+    for(uint8_t index = 0; index < AUTH_KEY_SIZE; index++)
+        k[index / 8] |= (uint64_t)key[index] << (8 * (index % 8));
+
+    state->v[0] = k[0] ^ 0x736f6d6570736575ULL;
+    state->v[1] = k[1] ^ 0x646f72616e646f6dULL;
+    state->v[2] = k[0] ^ 0x6c7967656e657261ULL;
+    state->v[3] = k[1] ^ 0x7465646279746573ULL;
+    state->block = 0;
+    state->length = 0;
+}
+
+//=======================================================================================================================
+// Acrescenta bytes à mensagem. A cada 8 bytes, um bloco é comprimido com 2 rodadas.
+//=======================================================================================================================
+static void sipUpdate(SipHash_t *state, uint8_t *data, uint8_t size)
+{
+    while(size--)
+    {
+        state->block |= (uint64_t)(*data++) << (8 * (state->length % 8));
+        if((++state->length % 8) == 0)
+        {
+            state->v[3] ^= state->block;
+            sipRounds(state, 2);
+            state->v[0] ^= state->block;
+            state->block = 0;
+        }
+    }
+}
+
+//=======================================================================================================================
+// Finaliza o SipHash-2-4 e copia os size primeiros bytes do resultado
+//=======================================================================================================================
+static void sipFinal(SipHash_t *state, uint8_t *tag, uint8_t size)
+{
+    uint64_t result;
+
+    state->block |= (uint64_t)state->length << 56;
+    state->v[3] ^= state->block;
+    sipRounds(state, 2);
+    state->v[0] ^= state->block;
+    state->v[2] ^= 0xFF;
+    sipRounds(state, 4);
+
+    result = state->v[0] ^ state->v[1] ^ state->v[2] ^ state->v[3];
+    for(uint8_t index = 0; index < size; index++)
+        tag[index] = (uint8_t)(result >> (8 * index));
+}
+
+//=======================================================================================================================
+// Compara dois MACs em tempo constante
+//=======================================================================================================================
+static uint8_t isTagEqual(uint8_t *expected, uint8_t *received, uint8_t size)
+{
+    uint8_t difference = 0;
+
+    for(uint8_t index = 0; index < size; index++)
+        difference |= expected[index] ^ received[index];
+    return(difference == 0);
+}
+
+//***********************************************************************************************************************
+// Funções públicas
+//***********************************************************************************************************************
+//=======================================================================================================================
+// Verifica se há uma chave gravada. A chave em si só é lida da EEPROM quando um quadro chega. Um Power-on Reset abre o
+// prazo para gravar a primeira chave.
+//=======================================================================================================================
+void initAuthentication(uint8_t powerOnReset)
+{
+    AuthState_t state;
+
+    if(powerOnReset)
+    {
+        provisioningWindow = 1;
+        provisioningStart = getTimerInterruptCount();
+    }
+
+    loadFromEEPROM((uint8_t *)&state, AUTH_EEPROM_ADDRESS, sizeof(AuthState_t));
+    authenticationEnabled = 0;
+    for(uint8_t index = 0; index < AUTH_KEY_SIZE; index++)
+    {
+        if(state.key[index] != 0xFF)
+            authenticationEnabled = 1;
+    }
+}
+
+//=======================================================================================================================
+// Indica se os comandos precisam chegar autenticados
+//=======================================================================================================================
+uint8_t isAuthenticationEnabled(void)
+{
+    return authenticationEnabled;
+}
+
+//=======================================================================================================================
+// Indica se a primeira chave pode ser gravada sem autenticação. Os bits de origem do comando podem ser preenchidos por
+// qualquer transmissor, então é exigida uma condição local: o módulo ainda sem chave, e religado há pouco tempo.
+//=======================================================================================================================
+uint8_t isAuthenticationProvisioningAllowed(void)
+{
+    return(!authenticationEnabled && provisioningWindow &&
+           (getTimerInterruptCount() - provisioningStart) < AUTH_PROVISION_WINDOW_MS);
+}
+
+//=======================================================================================================================
+// Confere o MAC e o contador de um quadro recebido em EXT_AUTH. Aceito, o contador é gravado, e repetições do mesmo
+// quadro passam a ser recusadas, inclusive depois de um Deep Sleep.
+//=======================================================================================================================
+uint8_t verifyAuthenticatedFrame(uint32_t counter, uint8_t *frame, uint8_t size, uint8_t *tag)
+{
+    AuthState_t state;
+    SipHash_t hash;
+    uint8_t expected[AUTH_TAG_SIZE], address = getNodeAddress();
+    uint32_t start;
+
+    if(!authenticationEnabled)
+        return 0;
+
+    loadFromEEPROM((uint8_t *)&state, AUTH_EEPROM_ADDRESS, sizeof(AuthState_t));
+    if(counter <= state.lastCounter)
+        return 0;
+
+    start = getTimerCycleCount();
+    sipInit(&hash, state.key);
+    sipUpdate(&hash, &address, 1);
+    sipUpdate(&hash, (uint8_t *)&counter, sizeof(uint32_t));
+    sipUpdate(&hash, frame, size);
+    sipFinal(&hash, expected, AUTH_TAG_SIZE);
+    costs.frameCycles = getTimerCycleCount() - start;
+
+    if(!isTagEqual(expected, tag, AUTH_TAG_SIZE))
+        return 0;
+
+    saveToEEPROM((uint8_t *)&counter, AUTH_EEPROM_ADDRESS + AUTH_KEY_SIZE, sizeof(uint32_t));
+    return 1;
+}
+
+//=======================================================================================================================
+// Grava uma nova chave e zera o contador. Uma chave toda em 0xFF desabilita a autenticação.
+//=======================================================================================================================
+void setAuthenticationKey(uint8_t *key)
+{
+    AuthState_t state;
+
+    for(uint8_t index = 0; index < AUTH_KEY_SIZE; index++)
+        state.key[index] = key[index];
+    state.lastCounter = 0;
+    saveToEEPROM((uint8_t *)&state, AUTH_EEPROM_ADDRESS, sizeof(AuthState_t));
+    initAuthentication(0);
+}
+
+//=======================================================================================================================
+// Início do resumo de dados longos, com a chave do módulo. Sem chave gravada, a chave apagada (toda em 0xFF) é usada, e
+// o resumo só protege contra corrupção.
+//=======================================================================================================================
+void beginAuthenticationDigest(void)
+{
+    AuthState_t state;
+
+    loadFromEEPROM((uint8_t *)&state, AUTH_EEPROM_ADDRESS, sizeof(AuthState_t));
+    digestStart = getTimerCycleCount();
+    sipInit(&digest, state.key);
+    costs.digestBytes = 0;
+}
+
+//=======================================================================================================================
+// Acrescenta dados ao resumo em andamento
+//=======================================================================================================================
+void updateAuthenticationDigest(uint8_t *data, uint8_t size)
+{
+    sipUpdate(&digest, data, size);
+    costs.digestBytes += size;
+}
+
+//=======================================================================================================================
+// Finaliza o resumo e o compara com o esperado, de AUTH_DIGEST_SIZE bytes. Retorna 1 se conferir.
+//=======================================================================================================================
+uint8_t checkAuthenticationDigest(uint8_t *expected)
+{
+    uint8_t result[AUTH_DIGEST_SIZE];
+
+    sipFinal(&digest, result, AUTH_DIGEST_SIZE);
+    costs.digestCycles = getTimerCycleCount() - digestStart;
+    return isTagEqual(result, expected, AUTH_DIGEST_SIZE);
+}
+
+//=======================================================================================================================
+// Situação da autenticação e custos medidos
+//=======================================================================================================================
+void getAuthenticationInfo(AuthInfo_t *info)
+{
+    *info = costs;
+    info->enabled = authenticationEnabled;
+    info->reserved = 0;
+}
+
+//***********************************************************************************************************************
\ No newline at end of file
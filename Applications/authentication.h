@@ -0,0 +1,61 @@
+//***********************************************************************************************************************
+//                              Estante Irrigada - Authentication
+//***********************************************************************************************************************
+#ifndef APPLICATION_AUTHENTICATION
+#define	APPLICATION_AUTHENTICATION
+
+#include <xc.h>
+
+//***********************************************************************************************************************
+// Definições
+//***********************************************************************************************************************
+#define AUTH_KEY_SIZE               16      // Chave do SipHash-2-4, 128 bits
+#define AUTH_TAG_SIZE               4       // Bytes do MAC transmitidos, dos 8 calculados
+#define AUTH_DIGEST_SIZE            8       // Resumo de dados longos, como o patch de firmware: o SipHash completo
+
+//***********************************************************************************************************************
+// Tipos de variáveis relacionadas ao módulo de autenticação
+//***********************************************************************************************************************
+//=======================================================================================================================
+// Chave do módulo e contador do último quadro aceito, guardados na EEPROM em AUTH_EEPROM_ADDRESS, fora da
+// configuração não volátil: uma mudança na configuração não apaga a chave. Chave toda em 0xFF (EEPROM apagada)
+// desabilita a autenticação.
+//
+// Envelope EXT_AUTH: [CMD_EXTENDED][EXT_AUTH][contador (uint32)][quadro interno][MAC (AUTH_TAG_SIZE)]. O MAC é o
+// SipHash-2-4 de [endereço do módulo][contador][quadro interno], e o contador tem de ser maior que o do último quadro
+// aceito.
+//=======================================================================================================================
+typedef struct
+{
+    uint8_t         key[AUTH_KEY_SIZE];
+    uint32_t        lastCounter;
+} AuthState_t;
+
+//=======================================================================================================================
+// Resposta a EXT_GET_AUTH_INFO. Custos medidos neste módulo, em ciclos de instrução, na última verificação de EXT_AUTH
+// e no último resumo calculado.
+//=======================================================================================================================
+typedef struct
+{
+    uint8_t         enabled;
+    uint8_t         reserved;
+    uint32_t        frameCycles;
+    uint32_t        digestCycles;
+    uint16_t        digestBytes;
+} AuthInfo_t;
+
+//***********************************************************************************************************************
+// Funções públicas do módulo
+//***********************************************************************************************************************
+extern void initAuthentication(uint8_t powerOnReset);
+extern uint8_t isAuthenticationEnabled(void);
+extern uint8_t isAuthenticationProvisioningAllowed(void);
+extern uint8_t verifyAuthenticatedFrame(uint32_t counter, uint8_t *frame, uint8_t size, uint8_t *tag);
+extern void setAuthenticationKey(uint8_t *key);
+extern void beginAuthenticationDigest(void);
+extern void updateAuthenticationDigest(uint8_t *data, uint8_t size);
+extern uint8_t checkAuthenticationDigest(uint8_t *digest);
+extern void getAuthenticationInfo(AuthInfo_t *info);
+
+#endif /* APPLICATION_AUTHENTICATION */
+//***********************************************************************************************************************
\ No newline at end of file
@@ -0,0 +1,187 @@
+//***********************************************************************************************************************
+//                                         Firmware Update
+//***********************************************************************************************************************
+#include "firmwareUpdate.h"
+#include "mainApplication.h"
+#include "../Configuration/HardwareConfiguration.h"
+#include "../Peripherals/EEPROM.h"
+#include "../Peripherals/Flash.h"
+#include "../Peripherals/timers.h"
+#include <xc.h>
+#include <string.h>
+
+//***********************************************************************************************************************
+// Definições privadas
+//***********************************************************************************************************************
+#define OTA_STAGE_SIZE          (OTA_STAGE_ROWS * FLASH_ROW_WORDS * 2)     // Bytes de patch na área de recepção
+#define OTA_BLOCKS_PER_ROW      ((FLASH_ROW_WORDS * 2) / OTA_BLOCK_SIZE)
+
+#if (OTA_STAGE_SIZE / OTA_BLOCK_SIZE) > 32
+#error "OtaState_t.received comporta no máximo 32 blocos"
+#endif
+
+typedef char otaEEPROMSizeCheck[((OTA_EEPROM_ADDRESS + sizeof(OtaState_t)) <= REPORT_EEPROM_ADDRESS) ? 1 : -1];
+
+//***********************************************************************************************************************
+// Variáveis privadas do módulo
+//***********************************************************************************************************************
+// Área de recepção do patch na memória de programa. Assim como o log de amostras, só os 16 bits inferiores de cada
+// instrução são usados.
+static const uint16_t __attribute__((space(prog), aligned(FLASH_ROW_WORDS * 2), noload)) otaStage[OTA_STAGE_ROWS * FLASH_ROW_WORDS];
+
+static OtaState_t otaState;
+static uint32_t lastActivity = 0;
+
+//***********************************************************************************************************************
+// Funções privadas
+//***********************************************************************************************************************
+//=======================================================================================================================
+// Blocos ainda não recebidos da atualização em andamento
+//=======================================================================================================================
+static uint32_t getMissingBlocks(void)
+{
+    uint8_t blocks = (otaState.patchSize + OTA_BLOCK_SIZE - 1) / OTA_BLOCK_SIZE;
+    uint32_t all = (blocks >= 32) ? 0xFFFFFFFF : ((1UL << blocks) - 1);
+
+    if(otaState.state != OTA_STATE_RECEIVING)
+        return 0;
+    return (all & ~otaState.received);
+}
+
+//=======================================================================================================================
+// Mantém o módulo acordado e ouvindo enquanto chegam quadros da atualização
+//=======================================================================================================================
+static void notifyFirmwareActivity(void)
+{
+    lastActivity = getTimerInterruptCount() | 1;
+    resetTimeOut();
+}
+
+//***********************************************************************************************************************
+// Funções públicas
+//***********************************************************************************************************************
+//=======================================================================================================================
+// Recupera o estado da atualização. Com a EEPROM apagada, ou com um estado inválido, não há atualização.
+//=======================================================================================================================
+void initFirmwareUpdate(void)
+{
+    loadFromEEPROM((uint8_t *)&otaState, OTA_EEPROM_ADDRESS, sizeof(OtaState_t));
+    if(otaState.state > OTA_STATE_READY || otaState.patchSize > OTA_STAGE_SIZE)
+        memset(&otaState, 0, sizeof(OtaState_t));
+}
+
+//=======================================================================================================================
+// Início de uma atualização. Se for a mesma já em andamento, os blocos recebidos são mantidos, e a transferência
+// continua de onde parou em um despertar anterior. Retorna 0 se o patch não servir para este módulo.
+//=======================================================================================================================
+uint8_t beginFirmwareUpdate(OtaBegin_t *begin)
+{
+    notifyFirmwareActivity();
+
+    if(otaState.state != OTA_STATE_IDLE && otaState.updateId == begin->updateId)
+        return 1;
+    if(begin->baseVersion != FIRMWARE_VERSION || begin->patchSize == 0 || begin->patchSize > OTA_STAGE_SIZE)
+        return 0;
+
+    otaState.state = OTA_STATE_RECEIVING;
+    otaState.updateId = begin->updateId;
+    otaState.newVersion = begin->newVersion;
+    otaState.patchSize = begin->patchSize;
+    memcpy(otaState.patchDigest, begin->patchDigest, AUTH_DIGEST_SIZE);
+    otaState.received = 0;
+    saveToEEPROM((uint8_t *)&otaState, OTA_EEPROM_ADDRESS, sizeof(OtaState_t));
+    return 1;
+}
+
+//=======================================================================================================================
+// Grava um bloco do patch na área de recepção. A linha da Flash que contém o bloco é lida, alterada, apagada e
+// reescrita. Blocos repetidos ou de outra atualização são descartados.
+//=======================================================================================================================
+void storeFirmwareBlock(uint16_t updateId, uint16_t index, uint8_t *data, uint8_t size)
+{
+    uint16_t row[FLASH_ROW_WORDS], page = __builtin_tblpage(otaStage), offset;
+    uint8_t firstWord;
+
+    if(otaState.state != OTA_STATE_RECEIVING || updateId != otaState.updateId || index >= 32 ||
+       (getMissingBlocks() & (1UL << index)) == 0)
+        return;
+    notifyFirmwareActivity();
+
+    if(size > OTA_BLOCK_SIZE)
+        size = OTA_BLOCK_SIZE;
+
+    offset = __builtin_tbloffset(otaStage) + ((index / OTA_BLOCKS_PER_ROW) * FLASH_ROW_WORDS * 2);
+    for(uint8_t word = 0; word < FLASH_ROW_WORDS; word++)
+        row[word] = flashReadWord(page, offset + (word * 2));
+
+    firstWord = (index % OTA_BLOCKS_PER_ROW) * (OTA_BLOCK_SIZE / 2);
+    memset(&row[firstWord], 0xFF, OTA_BLOCK_SIZE);
+    memcpy(&row[firstWord], data, size);
+    flashEraseRow(page, offset);
+    flashWriteRow(page, offset, row);
+
+    otaState.received |= (1UL << index);
+    saveToEEPROM((uint8_t *)&otaState.received, OTA_EEPROM_ADDRESS + ((uint8_t *)&otaState.received - (uint8_t *)&otaState), sizeof(uint32_t));
+}
+
+//=======================================================================================================================
+// Fim da transferência. Com todos os blocos recebidos e o resumo do patch correto, a atualização fica pronta para o
+// bootloader, em OTA_STATE_READY. Nada neste firmware aplica o patch. O resumo usa a chave do módulo e chega em
+// EXT_OTA_BEGIN autenticado: um CRC poderia ser reproduzido por blocos forjados. Retorna 0 se ainda faltar algo ou se o
+// patch não conferir.
+//=======================================================================================================================
+uint8_t commitFirmwareUpdate(uint16_t updateId)
+{
+    uint16_t word, page = __builtin_tblpage(otaStage);
+
+    notifyFirmwareActivity();
+
+    if(otaState.updateId != updateId)
+        return 0;
+    if(otaState.state == OTA_STATE_READY)
+        return 1;
+    if(otaState.state != OTA_STATE_RECEIVING || getMissingBlocks() != 0)
+        return 0;
+
+    beginAuthenticationDigest();
+    updateAuthenticationDigest((uint8_t *)&otaState.updateId, sizeof(uint16_t));
+    for(uint16_t index = 0; index < otaState.patchSize; index += 2)
+    {
+        word = flashReadWord(page, __builtin_tbloffset(otaStage) + index);
+        updateAuthenticationDigest((uint8_t *)&word, ((otaState.patchSize - index) > 1) ? 2 : 1);
+    }
+
+    if(!checkAuthenticationDigest(otaState.patchDigest))
+    {
+        // Patch corrompido na Flash: recomeça a recepção de todos os blocos
+        otaState.received = 0;
+        saveToEEPROM((uint8_t *)&otaState.received, OTA_EEPROM_ADDRESS + ((uint8_t *)&otaState.received - (uint8_t *)&otaState), sizeof(uint32_t));
+        return 0;
+    }
+
+    otaState.state = OTA_STATE_READY;
+    saveToEEPROM((uint8_t *)&otaState.state, OTA_EEPROM_ADDRESS, sizeof(uint16_t));
+    return 1;
+}
+
+//=======================================================================================================================
+// Situação da atualização, para a resposta ao roteador
+//=======================================================================================================================
+void getFirmwareUpdateStatus(OtaStatus_t *status)
+{
+    status->nodeAddress = getNodeAddress();
+    status->state = (uint8_t)otaState.state;
+    status->updateId = otaState.updateId;
+    status->firmwareVersion = FIRMWARE_VERSION;
+    status->missing = getMissingBlocks();
+}
+
+//=======================================================================================================================
+// Indica se há uma transferência em curso neste despertar. O rádio continua ouvindo depois da janela de recepção.
+//=======================================================================================================================
+uint8_t isFirmwareUpdateActive(void)
+{
+    return (lastActivity != 0 && (getTimerInterruptCount() - lastActivity) < OTA_SESSION_TIMEOUT_MS);
+}
+
+//***********************************************************************************************************************
\ No newline at end of file
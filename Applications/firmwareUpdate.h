@@ -0,0 +1,90 @@
+//***********************************************************************************************************************
+//                              Estante Irrigada - Firmware Update
+//***********************************************************************************************************************
+#ifndef APPLICATION_FIRMWARE_UPDATE
+#define	APPLICATION_FIRMWARE_UPDATE
+
+#include <xc.h>
+#include "authentication.h"
+
+//***********************************************************************************************************************
+// Definições
+//***********************************************************************************************************************
+//=======================================================================================================================
+// Estados da atualização, guardados na EEPROM. OTA_STATE_READY é a entrega a um bootloader, que aplicaria o patch no
+// próximo reset (o despertar do Deep Sleep também passa pelo vetor de reset) e voltaria o estado para OTA_STATE_IDLE.
+// Este projeto não tem bootloader, troca atômica de imagem nem a ferramenta que gera os patches: até que existam, um
+// patch pronto fica guardado na área de recepção e não é aplicado.
+//=======================================================================================================================
+#define OTA_STATE_IDLE              0
+#define OTA_STATE_RECEIVING         1
+#define OTA_STATE_READY             2
+
+//***********************************************************************************************************************
+// Tipos de variáveis relacionadas ao módulo de atualização de firmware
+//
+// O patch é uma sequência de registros [linha (uint16)][tamanho (uint8)][dados], um por linha de FLASH_ROW_WORDS
+// instruções alterada. Os dados são o XOR das instruções novas com as atuais, 3 bytes por instrução, comprimido com
+// RLE de zeros: um byte n < 0x80 vale n bytes zero; n >= 0x80 é seguido de (n - 0x7F) bytes literais. Linhas sem
+// registro não mudam. O módulo só recebe, guarda e confere o patch; aplicá-lo fica a cargo do bootloader. A área de
+// recepção, de OTA_STAGE_ROWS linhas, comporta apenas patches pequenos.
+//***********************************************************************************************************************
+//=======================================================================================================================
+// Início de uma atualização, após o GroupHeader_t de EXT_OTA_BEGIN
+//=======================================================================================================================
+typedef struct
+{
+    uint16_t        updateId;
+    uint16_t        baseVersion;        // Versão sobre a qual o patch foi gerado. Outras versões recusam.
+    uint16_t        newVersion;
+    uint16_t        patchSize;          // Em bytes, até OTA_STAGE_ROWS * FLASH_ROW_WORDS * 2
+    uint8_t         patchDigest[AUTH_DIGEST_SIZE];  // SipHash-2-4, com a chave do módulo, de [updateId][patch]
+} OtaBegin_t;
+
+//=======================================================================================================================
+// Cabeçalho de EXT_OTA_BLOCK, seguido de até OTA_BLOCK_SIZE bytes do patch. Enviado a todos: quem não participa da
+// atualização descarta pelo updateId.
+//=======================================================================================================================
+typedef struct
+{
+    uint16_t        updateId;
+    uint16_t        index;
+} OtaBlockHeader_t;
+
+//=======================================================================================================================
+// Resposta a EXT_OTA_STATUS e EXT_OTA_COMMIT. O roteador repete apenas os blocos que faltam a algum módulo.
+//=======================================================================================================================
+typedef struct
+{
+    uint8_t         nodeAddress;
+    uint8_t         state;
+    uint16_t        updateId;
+    uint16_t        firmwareVersion;
+    uint32_t        missing;            // Um bit por bloco ainda não recebido
+} OtaStatus_t;
+
+//=======================================================================================================================
+// Estado da atualização guardado na EEPROM, em OTA_EEPROM_ADDRESS
+//=======================================================================================================================
+typedef struct
+{
+    uint16_t        state;
+    uint16_t        updateId;
+    uint16_t        newVersion;
+    uint16_t        patchSize;
+    uint8_t         patchDigest[AUTH_DIGEST_SIZE];
+    uint32_t        received;           // Um bit por bloco já gravado na área de recepção
+} OtaState_t;
+
+//***********************************************************************************************************************
+// Funções públicas do módulo
+//***********************************************************************************************************************
+extern void initFirmwareUpdate(void);
+extern uint8_t beginFirmwareUpdate(OtaBegin_t *begin);
+extern void storeFirmwareBlock(uint16_t updateId, uint16_t index, uint8_t *data, uint8_t size);
+extern uint8_t commitFirmwareUpdate(uint16_t updateId);
+extern void getFirmwareUpdateStatus(OtaStatus_t *status);
+extern uint8_t isFirmwareUpdateActive(void);
+
+#endif /* APPLICATION_FIRMWARE_UPDATE */
+//***********************************************************************************************************************
\ No newline at end of file
@@ -0,0 +1,123 @@
+//***********************************************************************************************************************
+//                                         Link Adaptation
+//***********************************************************************************************************************
+#include "linkAdaptation.h"
+#include "mainApplication.h"
+#include "../Configuration/HardwareConfiguration.h"
+#include "../Peripherals/LoRa.h"
+#include <xc.h>
+
+//***********************************************************************************************************************
+// Variáveis privadas do módulo
+//***********************************************************************************************************************
+static uint8_t routerHeard = 0, replyExpected = 0;
+
+//***********************************************************************************************************************
+// Funções públicas
+//***********************************************************************************************************************
+//=======================================================================================================================
+// Registra que o roteador foi ouvido neste despertar, guardando a qualidade do último pacote recebido
+//=======================================================================================================================
+void notifyRouterReception(void)
+{
+    int16_t rssi = getLoRaPacketRssi();
+
+    // Limita o RSSI à faixa representável em um byte, sem que se confunda com "sem medida"
+    if(rssi < -255)
+        rssi = -255;
+    else if(rssi > -1)
+        rssi = -1;
+
+    // A RAM é perdida no Deep Sleep, então o estado do enlace entre despertares fica nos registradores preservados
+    RETAINED_LINK_QUALITY = ((uint16_t)(uint8_t)getLoRaPacketSnr() << 8) | (uint8_t)(-rssi);
+    setRetainedMissedReplies(0);
+    routerHeard = 1;
+
+    confirmModemConfiguration();
+}
+
+//=======================================================================================================================
+// Registra que foi enviado neste despertar um quadro ao qual o roteador responde: amostra, requisição de mensagens ou
+// de horário. Só então o silêncio do roteador conta como falha do enlace.
+//=======================================================================================================================
+void notifyReplyExpected(void)
+{
+    replyExpected = 1;
+}
+
+//=======================================================================================================================
+// Monta o relatório de qualidade do enlace para o roteador
+//=======================================================================================================================
+void getLinkReport(LinkReport_t *report)
+{
+    LoRaModemConfig_t *config = getModemConfiguration();
+
+    report->nodeAddress = getNodeAddress();
+    report->spreadingFactor = config->spreadingFactor;
+    report->txPower = config->txPower;
+    report->missedReplies = getRetainedMissedReplies();
+    report->airtimeCredit = getLoRaAirtimeCredit();
+
+    // Byte baixo zerado indica que não há medida desde o Power-on Reset
+    if((RETAINED_LINK_QUALITY & 0x00FF) == 0)
+    {
+        report->snr = 0;
+        report->margin = 0;
+        report->rssi = 0;
+    }
+    else
+    {
+        report->snr = (int8_t)(RETAINED_LINK_QUALITY >> 8);
+        report->rssi = -(int16_t)(RETAINED_LINK_QUALITY & 0x00FF);
+        // O SNR mínimo de demodulação é -7,5dB no SF7 e cai 2,5dB a cada SF, ou seja, -(SF - 4) * 10 quartos de dB.
+        report->margin = report->snr + ((config->spreadingFactor - 4) * 10);
+    }
+}
+
+//=======================================================================================================================
+// Indica se o roteador foi ouvido neste despertar
+//=======================================================================================================================
+uint8_t isRouterHeard(void)
+{
+    return routerHeard;
+}
+
+//=======================================================================================================================
+// Fecha o ciclo de comunicação antes do Deep Sleep. Se o roteador não respondeu a um quadro enviado, conta a falha e, a
+// cada LINK_MISSES_PER_STEP falhas, sobe um degrau: primeiro a potência, até LINK_MAX_TX_POWER, e depois o SF.
+// A contagem recomeça a cada degrau. Despertares sem nada enviado, como os de envio segurado pela falta de crédito de
+// tempo no ar, não contam: subir o enlace gastaria ainda mais crédito.
+// Uma configuração em teste não sobe degraus, pois ela mesma é revertida se o roteador não for ouvido.
+//=======================================================================================================================
+void finishLinkCycle(void)
+{
+    LoRaModemConfig_t config;
+    uint8_t missedReplies;
+
+    if(routerHeard || !replyExpected || isModemConfigurationOnTrial())
+        return;
+
+    missedReplies = getRetainedMissedReplies() + 1;
+    if(missedReplies < LINK_MISSES_PER_STEP)
+        setRetainedMissedReplies(missedReplies);
+    else
+    {
+        setRetainedMissedReplies(0);
+        config = *getModemConfiguration();
+
+        if(config.txPower < LINK_MAX_TX_POWER)
+        {
+            config.txPower += LINK_TX_POWER_STEP;
+            if(config.txPower > LINK_MAX_TX_POWER)
+                config.txPower = LINK_MAX_TX_POWER;
+        }
+        else if(config.spreadingFactor < LORA_MAX_SF)
+            config.spreadingFactor++;
+        else
+            return;     // Enlace já está no máximo
+
+        commitModemConfiguration(&config);
+    }
+}
+
+//***********************************************************************************************************************
\ No newline at end of file
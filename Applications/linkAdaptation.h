@@ -0,0 +1,37 @@
+//***********************************************************************************************************************
+//                              Estante Irrigada - Link Adaptation
+//***********************************************************************************************************************
+#ifndef APPLICATION_LINK_ADAPTATION
+#define	APPLICATION_LINK_ADAPTATION
+
+#include <xc.h>
+
+//***********************************************************************************************************************
+// Tipos de variáveis relacionadas ao módulo de adaptação do enlace
+//***********************************************************************************************************************
+//=======================================================================================================================
+// Relatório de qualidade do enlace, enviado ao roteador junto com as requisições
+//=======================================================================================================================
+typedef struct
+{
+    uint8_t         nodeAddress;
+    uint8_t         spreadingFactor;
+    int8_t          txPower;            // dBm
+    int8_t          snr;                // Último pacote do roteador, em quartos de dB
+    int8_t          margin;             // SNR acima do mínimo de demodulação do SF atual, em quartos de dB
+    uint8_t         missedReplies;      // Despertares com envio sem resposta desde o último degrau de aumento do enlace
+    int16_t         rssi;               // Último pacote do roteador, em dBm. 0 se não houver medida.
+    uint16_t        airtimeCredit;      // Crédito de tempo no ar disponível na janela de duty cycle, em ms
+} LinkReport_t;
+
+//***********************************************************************************************************************
+// Funções públicas do módulo
+//***********************************************************************************************************************
+extern void notifyRouterReception(void);
+extern void notifyReplyExpected(void);
+extern void getLinkReport(LinkReport_t *report);
+extern void finishLinkCycle(void);
+extern uint8_t isRouterHeard(void);
+
+#endif /* APPLICATION_LINK_ADAPTATION */
+//***********************************************************************************************************************
\ No newline at end of file
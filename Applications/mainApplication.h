@@ -1,13 +1,16 @@
 //***********************************************************************************************************************
-//                              Estante Irrigada - Definio de pinosz
+//                              Estante Irrigada - Definição de pinosz
 //***********************************************************************************************************************
 #ifndef PARENT_APPLICATION
 #define	PARENT_APPLICATION
 
 #include <xc.h>
+#include "../Peripherals/LoRa.h"
+#include "timeSync.h"
+#include "relay.h"
 
 //***********************************************************************************************************************
-// Definies
+// Definições
 //***********************************************************************************************************************
 //=======================================================================================================================
 // Estatos do TIME-OUT
@@ -16,14 +19,51 @@
 #define TIME_OUT_ENABLED                1
 #define FORCE_TIMEOUT                   2
 
+//=======================================================================================================================
+// Registradores preservados no Deep Sleep. A RAM é perdida a cada Deep Sleep, e estes são os únicos registradores
+// mantidos entre despertares. São zerados no Power-on Reset.
+//   DSGPR0: qualidade do último pacote do roteador (linkAdaptation). Byte alto = SNR, byte baixo = -RSSI.
+//   DSGPR1: bits 15-4 = crédito de tempo no ar, em unidades de 10ms; bits 3-0 = despertares sem ouvir o roteador.
+//=======================================================================================================================
+#define RETAINED_LINK_QUALITY           DSGPR0
+#define getRetainedAirtimeCredit()      (DSGPR1 >> 4)
+#define setRetainedAirtimeCredit(v)     DSGPR1 = (DSGPR1 & 0x000F) | ((v) << 4)
+#define getRetainedMissedReplies()      (DSGPR1 & 0x000F)
+#define setRetainedMissedReplies(v)     DSGPR1 = (DSGPR1 & 0xFFF0) | ((v) & 0x000F)
+
 //***********************************************************************************************************************
-// Funes pblicas da aplicao principal, que podem ser acessadas pelas aplicaes filho
+// Funções públicas da aplicação principal, que podem ser acessadas pelas aplicações filho
 //***********************************************************************************************************************
 extern uint8_t saveConfiguration(void);
+extern uint16_t getConfigurationHash(void);
+extern uint16_t updateCRC16(uint16_t crc, uint8_t *data, uint16_t size);
 extern void deepSleep(void);
 extern void forceTaskSetup(void);
+extern uint8_t isMulticastListening(void);
 extern void resetTimeOut(void);
 extern void setTimeOutState(uint8_t state);
+extern uint8_t getTimeOutState(void);
+extern uint8_t setModemConfiguration(LoRaModemConfig_t *config);
+extern void confirmModemConfiguration(void);
+extern void commitModemConfiguration(LoRaModemConfig_t *config);
+extern LoRaModemConfig_t *getModemConfiguration(void);
+extern uint8_t isModemConfigurationOnTrial(void);
+extern uint16_t getHeartbeatInterval(void);
+extern void setHeartbeatInterval(uint16_t minutes);
+extern uint16_t getSummaryInterval(void);
+extern void setSummaryInterval(uint16_t minutes);
+extern uint16_t getSampleInterval(void);
+extern void setSampleInterval(uint16_t minutes);
+extern uint8_t getNodeAddress(void);
+extern void setNodeAddress(uint8_t address);
+extern uint16_t getGroupMembership(void);
+extern void setGroupMembership(uint16_t groups);
+extern UplinkSlot_t *getUplinkSlot(void);
+extern void setUplinkSlot(UplinkSlot_t *slot);
+extern TimeSyncState_t *getTimeSyncState(void);
+extern void saveTimeSyncState(TimeSyncState_t *state);
+extern RelayConfig_t *getRelayConfig(void);
+extern void saveRelayConfig(RelayConfig_t *config);
 
 #endif	/* PARENT_APPLICATION */
 //***********************************************************************************************************************
@@ -0,0 +1,277 @@
+//***********************************************************************************************************************
+//                                         Relay
+//***********************************************************************************************************************
+#include "relay.h"
+#include "LoRaReception.h"
+#include "linkAdaptation.h"
+#include "mainApplication.h"
+#include "../Configuration/HardwareConfiguration.h"
+#include "../Peripherals/LoRa.h"
+#include "../Peripherals/timers.h"
+#include <xc.h>
+#include <stddef.h>
+
+//***********************************************************************************************************************
+// Variáveis privadas do módulo
+//***********************************************************************************************************************
+// Caminho de volta para os módulos cujos quadros passaram por este relay
+static struct
+{
+    uint8_t         address;
+    uint8_t         nextHop;
+    uint32_t        lastHeard;
+} routes[RELAY_ROUTE_TABLE_SIZE];
+
+// Quadros já tratados, para descartar os que chegam de novo por outro caminho
+static struct
+{
+    uint8_t         origin;
+    uint8_t         sequence;
+    uint32_t        tick;
+} recentFrames[RELAY_RECENT_FRAMES];
+
+static uint8_t recentNext = 0, relaySequence = 0;
+static uint8_t advertisePending = 0, discoveryDone = 0;
+static uint32_t advertiseTick = 0, advertiseDelay = 0, lastAdvertiseTick = 0, discoveryTick = 0;
+
+//***********************************************************************************************************************
+// Funções privadas
+//***********************************************************************************************************************
+//=======================================================================================================================
+// Próximo salto para um módulo abaixo deste relay. Sem caminho conhecido, tenta o próprio módulo.
+//=======================================================================================================================
+static uint8_t findRoute(uint8_t address, uint8_t *found)
+{
+    for(uint8_t index = 0; index < RELAY_ROUTE_TABLE_SIZE; index++)
+    {
+        if(routes[index].lastHeard != 0 && routes[index].address == address)
+        {
+            *found = 1;
+            return routes[index].nextHop;
+        }
+    }
+    *found = 0;
+    return address;
+}
+
+//=======================================================================================================================
+// Guarda o caminho de volta para um módulo. Com a tabela cheia, substitui o caminho mais antigo.
+//=======================================================================================================================
+static void learnRoute(uint8_t address, uint8_t nextHop)
+{
+    uint8_t slot = 0;
+
+    for(uint8_t index = 0; index < RELAY_ROUTE_TABLE_SIZE; index++)
+    {
+        if(routes[index].lastHeard != 0 && routes[index].address == address)
+        {
+            slot = index;
+            break;
+        }
+        if(routes[index].lastHeard < routes[slot].lastHeard)
+            slot = index;
+    }
+    routes[slot].address = address;
+    routes[slot].nextHop = nextHop;
+    routes[slot].lastHeard = getTimerInterruptCount() | 1;     // Zero indica entrada livre
+}
+
+//=======================================================================================================================
+// Indica se um quadro já foi tratado há menos de RELAY_DUPLICATE_MS, e o registra caso contrário. As sequências
+// recomeçam a cada despertar dos módulos, então a lembrança tem de expirar antes do próximo.
+//=======================================================================================================================
+static uint8_t isDuplicateFrame(uint8_t origin, uint8_t sequence)
+{
+    uint32_t now = getTimerInterruptCount();
+
+    for(uint8_t index = 0; index < RELAY_RECENT_FRAMES; index++)
+    {
+        if(recentFrames[index].tick != 0 && recentFrames[index].origin == origin &&
+           recentFrames[index].sequence == sequence && (now - recentFrames[index].tick) < RELAY_DUPLICATE_MS)
+            return 1;
+    }
+
+    recentFrames[recentNext].origin = origin;
+    recentFrames[recentNext].sequence = sequence;
+    recentFrames[recentNext].tick = now | 1;
+    recentNext = (recentNext + 1) % RELAY_RECENT_FRAMES;
+    return 0;
+}
+
+//***********************************************************************************************************************
+// Funções públicas
+//***********************************************************************************************************************
+//=======================================================================================================================
+// Indica se o módulo encaminha quadros de outros módulos
+//=======================================================================================================================
+uint8_t isRelayNode(void)
+{
+    return (getRelayConfig()->role == RELAY_ROLE_RELAY);
+}
+
+//=======================================================================================================================
+// Indica se os quadros para o roteador passam por um relay
+//=======================================================================================================================
+uint8_t isRelayedUplink(void)
+{
+    return (getRelayConfig()->parent != RELAY_ROUTER_ADDRESS);
+}
+
+//=======================================================================================================================
+// Indica se o rádio deve continuar ouvindo depois da janela de recepção. Relays ouvem o tempo todo. As respostas a
+// módulos atrás de um relay chegam depois de vários saltos, fora da janela, e a descoberta espera os anúncios.
+//=======================================================================================================================
+uint8_t isRelayListening(void)
+{
+    if(isRelayNode() || isRelayedUplink())
+        return 1;
+    return (discoveryTick != 0 && (getTimerInterruptCount() - discoveryTick) < RELAY_DISCOVERY_WINDOW_MS);
+}
+
+//=======================================================================================================================
+// Cabeçalho para um quadro do próprio módulo ao roteador, pelo pai atual
+//=======================================================================================================================
+void buildRelayHeader(RelayHeader_t *header)
+{
+    header->destination = getRelayConfig()->parent;
+    header->sender = getNodeAddress();
+    header->origin = getNodeAddress();
+    header->target = RELAY_ROUTER_ADDRESS;
+    header->hops = 0;
+    header->sequence = relaySequence++;
+}
+
+//=======================================================================================================================
+// Decide o destino de um envelope recebido. Na subida, o relay aprende o caminho de volta para a origem e encaminha
+// ao seu pai; na descida, encaminha pelo caminho aprendido.
+//=======================================================================================================================
+uint8_t routeRelayFrame(RelayHeader_t *header)
+{
+    RelayConfig_t *config = getRelayConfig();
+    uint8_t address = getNodeAddress(), found;
+
+    if(header->destination != address || isDuplicateFrame(header->origin, header->sequence))
+        return RELAY_DROP;
+    if(header->target == address)
+        return RELAY_DELIVER;
+    if(config->role != RELAY_ROLE_RELAY || header->hops >= RELAY_MAX_HOPS)
+        return RELAY_DROP;
+
+    if(header->target == RELAY_ROUTER_ADDRESS)
+    {
+        learnRoute(header->origin, header->sender);
+        header->destination = config->parent;
+    }
+    else
+        header->destination = findRoute(header->target, &found);
+    header->sender = address;
+    header->hops++;
+    return RELAY_FORWARD;
+}
+
+//=======================================================================================================================
+// Avalia um candidato a pai: um relay que se anunciou ou o próprio roteador, ouvido diretamente (hops = 0). A
+// qualidade é o SNR do pacote menos RELAY_HOP_PENALTY por salto, e só um candidato melhor que o pai atual por mais de
+// RELAY_PARENT_HYSTERESIS o substitui. A configuração só é gravada quando muda.
+//=======================================================================================================================
+void notifyRelayCandidate(uint8_t address, uint8_t hops)
+{
+    RelayConfig_t config = *getRelayConfig();
+    int16_t score = getLoRaPacketSnr() - ((int16_t)hops * RELAY_HOP_PENALTY);
+    uint8_t found;
+
+    if(address == getNodeAddress() || hops >= RELAY_MAX_HOPS)
+        return;
+
+    // Um relay não se liga a um módulo que está abaixo dele, o que formaria um laço
+    findRoute(address, &found);
+    if(found)
+        return;
+
+    if(score < -127)
+        score = -127;
+
+    if(address == config.parent)
+    {
+        if(score > (config.parentScore + RELAY_PARENT_HYSTERESIS) || score < (config.parentScore - RELAY_PARENT_HYSTERESIS))
+            config.parentScore = (int8_t)score;
+    }
+    else if(score > (config.parentScore + RELAY_PARENT_HYSTERESIS))
+    {
+        config.parent = address;
+        config.parentScore = (int8_t)score;
+    }
+    config.hops = (config.parent == address) ? (hops + 1) : config.hops;
+
+    saveRelayConfig(&config);
+}
+
+//=======================================================================================================================
+// Pedido de anúncio de um módulo à procura de pai. Os relays respondem na janela do seu endereço, para não colidirem.
+//=======================================================================================================================
+void requestRelayAdvertise(void)
+{
+    if(!isRelayNode())
+        return;
+    advertisePending = 1;
+    advertiseTick = getTimerInterruptCount();
+    advertiseDelay = (uint32_t)(getNodeAddress() % 16) * RELAY_ADVERTISE_SLOT_MS;
+}
+
+//=======================================================================================================================
+// Tarefa do encaminhamento. Nos relays, envia os anúncios. Nos demais, pede anúncios se o roteador não foi ouvido no
+// último despertar.
+//=======================================================================================================================
+void taskRelay(void)
+{
+    RelayAdvertise_t advertise;
+    uint32_t now = getTimerInterruptCount();
+
+    if(isRelayNode())
+    {
+        if(!advertisePending && (lastAdvertiseTick == 0 || (now - lastAdvertiseTick) >= RELAY_ADVERTISE_INTERVAL_MS))
+            requestRelayAdvertise();
+
+        if(advertisePending && (now - advertiseTick) >= advertiseDelay)
+        {
+            advertise.address = getNodeAddress();
+            advertise.hops = getRelayConfig()->hops;
+            sendExtendedPacket(BROAD_COMMAND, EXT_RELAY_ADVERTISE, (unsigned char *)&advertise, sizeof(RelayAdvertise_t));
+            advertisePending = 0;
+            lastAdvertiseTick = now | 1;
+        }
+    }
+    else if(!discoveryDone)
+    {
+        discoveryDone = 1;
+        if(getRetainedMissedReplies() > 0 && isLowPriorityTrafficAllowed())
+        {
+            sendExtendedPacket(BROAD_COMMAND, EXT_RELAY_DISCOVER, NULL, 0);
+            discoveryTick = now | 1;
+            resetTimeOut();
+        }
+    }
+}
+
+//=======================================================================================================================
+// Fim do despertar, chamada antes do Deep Sleep. Sem ouvir o roteador, o pai atual perde a sua medida, para que o
+// próximo anúncio ouvido o substitua. Se o pai for um relay e falhar em dois despertares seguidos, o módulo volta a
+// falar diretamente com o roteador.
+//=======================================================================================================================
+void finishRelayCycle(void)
+{
+    RelayConfig_t config = *getRelayConfig();
+
+    if(isRouterHeard())
+        return;
+
+    if(config.parent != RELAY_ROUTER_ADDRESS && getRetainedMissedReplies() > 0)
+    {
+        config.parent = RELAY_ROUTER_ADDRESS;
+        config.hops = 1;
+    }
+    config.parentScore = RELAY_SCORE_NONE;
+    saveRelayConfig(&config);
+}
+
+//***********************************************************************************************************************
\ No newline at end of file
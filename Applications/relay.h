@@ -0,0 +1,78 @@
+//***********************************************************************************************************************
+//                              Estante Irrigada - Relay
+//***********************************************************************************************************************
+#ifndef APPLICATION_RELAY
+#define	APPLICATION_RELAY
+
+#include <xc.h>
+
+//***********************************************************************************************************************
+// Definições
+//***********************************************************************************************************************
+#define RELAY_ROLE_LEAF             0       // Só transmite os próprios quadros e mantém o ciclo de Deep Sleep
+#define RELAY_ROLE_RELAY            1       // Encaminha quadros de outros módulos. Permanece acordado.
+
+#define RELAY_ROUTER_ADDRESS        0xFE    // Endereço do roteador nos envelopes EXT_RELAY
+#define RELAY_SCORE_NONE            -128    // Pai sem medida de qualidade: qualquer candidato ouvido o substitui
+
+// Destino de um envelope recebido
+#define RELAY_DROP                  0
+#define RELAY_DELIVER               1       // Endereçado a este módulo: o quadro interno é executado
+#define RELAY_FORWARD               2       // Encaminhado ao próximo salto, com o cabeçalho já atualizado
+
+//***********************************************************************************************************************
+// Tipos de variáveis relacionadas ao módulo de encaminhamento
+//***********************************************************************************************************************
+//=======================================================================================================================
+// Papel do módulo e pai escolhido, guardados na configuração não volátil
+//=======================================================================================================================
+typedef struct
+{
+    uint8_t         role;
+    uint8_t         parent;             // Próximo salto em direção ao roteador. RELAY_ROUTER_ADDRESS se for direto.
+    uint8_t         hops;               // Saltos até o roteador por este pai
+    int8_t          parentScore;        // SNR do pai, em quartos de dB, descontado o custo dos saltos
+} RelayConfig_t;
+
+//=======================================================================================================================
+// Cabeçalho do envelope EXT_RELAY, seguido do quadro interno (comando + payload). Na subida, target é o roteador; na
+// descida, origin é o roteador.
+//=======================================================================================================================
+typedef struct
+{
+    uint8_t         destination;        // Próximo salto
+    uint8_t         sender;             // Salto anterior
+    uint8_t         origin;
+    uint8_t         target;
+    uint8_t         hops;               // Saltos já percorridos
+    uint8_t         sequence;           // Por origem, para descartar quadros ouvidos por mais de um caminho
+} RelayHeader_t;
+
+// Maior payload de um quadro do módulo dentro de EXT_RELAY: o envelope ocupa o código EXT_RELAY, o RelayHeader_t e o
+// comando interno
+#define RELAY_INNER_PAYLOAD_SIZE    (MAX_PACKET_SIZE - 3 - sizeof(RelayHeader_t))
+
+//=======================================================================================================================
+// Anúncio de um relay, enviado periodicamente e em resposta a EXT_RELAY_DISCOVER
+//=======================================================================================================================
+typedef struct
+{
+    uint8_t         address;
+    uint8_t         hops;               // Saltos do relay até o roteador
+} RelayAdvertise_t;
+
+//***********************************************************************************************************************
+// Funções públicas do módulo
+//***********************************************************************************************************************
+extern uint8_t isRelayNode(void);
+extern uint8_t isRelayedUplink(void);
+extern uint8_t isRelayListening(void);
+extern void buildRelayHeader(RelayHeader_t *header);
+extern uint8_t routeRelayFrame(RelayHeader_t *header);
+extern void notifyRelayCandidate(uint8_t address, uint8_t hops);
+extern void requestRelayAdvertise(void);
+extern void taskRelay(void);
+extern void finishRelayCycle(void);
+
+#endif /* APPLICATION_RELAY */
+//***********************************************************************************************************************
\ No newline at end of file
@@ -0,0 +1,193 @@
+//***********************************************************************************************************************
+//                                         Sample Log
+//***********************************************************************************************************************
+#include "sampleLog.h"
+#include "../Configuration/HardwareConfiguration.h"
+#include "../Peripherals/Flash.h"
+#include "../Peripherals/EEPROM.h"
+#include <string.h>
+
+//***********************************************************************************************************************
+// Definições internas
+//***********************************************************************************************************************
+// Cada linha da Flash guarda, na primeira palavra, a sequência do seu primeiro registro, seguida de
+// SAMPLE_LOG_RECORDS_PER_ROW registros consecutivos. Como a Flash só é escrita por linha inteira, os registros de uma
+// linha incompleta ficam na EEPROM até que a linha seja completada, e por isso uma linha tem no máximo um registro a
+// mais do que cabe na EEPROM. Um registro cuja palavra alta do instante está no estado apagado (0xFFFF) está vazio: o
+// instante, em segundos desde 1970, só chega a 0xFFFF0000 em 2106. A sequência pode valer 0xFFFF, então uma linha
+// vazia é reconhecida pelo seu primeiro registro.
+#define RECORD_WORDS                (sizeof(PackedSample_t) / sizeof(uint16_t))
+#define RECORD_MARK_WORD            1       // Palavra alta de PackedSample_t.timestamp
+#define EEPROM_RECORDS              ((EEPROM_SIZE - SAMPLE_LOG_EEPROM_ADDRESS) / sizeof(PackedSample_t))
+#define SAMPLE_LOG_RECORDS_PER_ROW  ((((FLASH_ROW_WORDS - 1) / RECORD_WORDS) < (EEPROM_RECORDS + 1)) ? \
+                                     ((FLASH_ROW_WORDS - 1) / RECORD_WORDS) : (EEPROM_RECORDS + 1))
+#define SAMPLE_LOG_STAGED_RECORDS   (SAMPLE_LOG_RECORDS_PER_ROW - 1)
+#define EMPTY_WORD                  0xFFFF
+
+typedef char sampleLogEEPROMSizeCheck[((SAMPLE_LOG_EEPROM_ADDRESS + (SAMPLE_LOG_STAGED_RECORDS * sizeof(PackedSample_t))) <= EEPROM_SIZE) ? 1 : -1];
+
+//***********************************************************************************************************************
+// Variáveis privadas do módulo
+//***********************************************************************************************************************
+// Área reservada na memória de programa. noload: o programador não grava esta área, que mantém o log entre
+// regravações do firmware que não mudem a sua posição.
+static const uint16_t __attribute__((space(prog), aligned(FLASH_ROW_WORDS * 2), noload)) sampleLog[SAMPLE_LOG_ROWS * FLASH_ROW_WORDS];
+
+static uint8_t newestRow = 0, stagedRecords = 0, logEmpty = 1;
+static uint16_t newestSequence = 0;
+
+//***********************************************************************************************************************
+// Funções privadas
+//***********************************************************************************************************************
+//=======================================================================================================================
+// Offset, na memória de programa, de uma palavra do log
+//=======================================================================================================================
+static uint16_t getLogOffset(uint8_t row, uint8_t word)
+{
+    return(__builtin_tbloffset(sampleLog) + ((((uint16_t)row * FLASH_ROW_WORDS) + word) * 2));
+}
+
+//=======================================================================================================================
+// Indica se uma linha da Flash já foi escrita
+//=======================================================================================================================
+static uint8_t isRowWritten(uint8_t row)
+{
+    return(flashReadWord(__builtin_tblpage(sampleLog), getLogOffset(row, 1 + RECORD_MARK_WORD)) != EMPTY_WORD);
+}
+
+//=======================================================================================================================
+// Endereço, na EEPROM, de um registro de uma linha incompleta
+//=======================================================================================================================
+static uint16_t getStagedAddress(uint8_t record)
+{
+    return(SAMPLE_LOG_EEPROM_ADDRESS + (record * sizeof(PackedSample_t)));
+}
+
+//=======================================================================================================================
+// Sequência do primeiro registro da próxima linha a ser escrita
+//=======================================================================================================================
+static uint16_t getNextRowSequence(void)
+{
+    return(logEmpty ? 0 : (newestSequence + SAMPLE_LOG_RECORDS_PER_ROW));
+}
+
+//***********************************************************************************************************************
+// Funções públicas
+//***********************************************************************************************************************
+//=======================================================================================================================
+// Localiza a linha mais recente do log e os registros pendentes na EEPROM. A RAM é perdida no Deep Sleep, então isto
+// é refeito a cada despertar.
+//=======================================================================================================================
+void initSampleLog(void)
+{
+    uint16_t sequence, page = __builtin_tblpage(sampleLog);
+
+    logEmpty = 1;
+    for(uint8_t row = 0; row < SAMPLE_LOG_ROWS; row++)
+    {
+        if(!isRowWritten(row))
+            continue;
+
+        sequence = flashReadWord(page, getLogOffset(row, 0));
+        if(logEmpty || (int16_t)(sequence - newestSequence) > 0)
+        {
+            newestSequence = sequence;
+            newestRow = row;
+            logEmpty = 0;
+        }
+    }
+
+    stagedRecords = 0;
+    while(stagedRecords < SAMPLE_LOG_STAGED_RECORDS && eepromReadWord((getStagedAddress(stagedRecords) >> 1) + RECORD_MARK_WORD) != EMPTY_WORD)
+        stagedRecords++;
+}
+
+//=======================================================================================================================
+// Acrescenta um registro ao log. Ao completar uma linha, ela é gravada na Flash sobre a linha mais antiga.
+//=======================================================================================================================
+void logSample(PackedSample_t *sample)
+{
+    uint16_t row[FLASH_ROW_WORDS], page = __builtin_tblpage(sampleLog);
+    uint8_t rowIndex;
+
+    if(stagedRecords < SAMPLE_LOG_STAGED_RECORDS)
+    {
+        saveToEEPROM((uint8_t *)sample, getStagedAddress(stagedRecords), sizeof(PackedSample_t));
+        stagedRecords++;
+        return;
+    }
+
+    memset(row, 0xFF, sizeof(row));
+    row[0] = getNextRowSequence();
+    loadFromEEPROM((uint8_t *)&row[1], getStagedAddress(0), SAMPLE_LOG_STAGED_RECORDS * sizeof(PackedSample_t));
+    memcpy(&row[1 + (SAMPLE_LOG_STAGED_RECORDS * RECORD_WORDS)], sample, sizeof(PackedSample_t));
+
+    rowIndex = logEmpty ? 0 : ((newestRow + 1) % SAMPLE_LOG_ROWS);
+    flashEraseRow(page, getLogOffset(rowIndex, 0));
+    flashWriteRow(page, getLogOffset(rowIndex, 0), row);
+
+    newestRow = rowIndex;
+    newestSequence = row[0];
+    logEmpty = 0;
+
+    // Basta marcar cada registro pendente como vazio
+    for(uint8_t record = 0; record < SAMPLE_LOG_STAGED_RECORDS; record++)
+        eepromWriteWord((getStagedAddress(record) >> 1) + RECORD_MARK_WORD, EMPTY_WORD);
+    stagedRecords = 0;
+}
+
+//=======================================================================================================================
+// Faixa de sequências disponíveis no log
+//=======================================================================================================================
+void getSampleLogInfo(SampleLogInfo_t *info)
+{
+    uint8_t oldestRow = (newestRow + 1) % SAMPLE_LOG_ROWS;
+
+    info->firstSequence = getNextRowSequence();
+    if(!logEmpty)
+    {
+        // Enquanto o log não deu a volta, a linha seguinte à mais recente ainda está vazia e a mais antiga é a primeira
+        if(!isRowWritten(oldestRow))
+            oldestRow = 0;
+        info->firstSequence = flashReadWord(__builtin_tblpage(sampleLog), getLogOffset(oldestRow, 0));
+    }
+    info->count = getNextRowSequence() + stagedRecords - info->firstSequence;
+}
+
+//=======================================================================================================================
+// Lê um registro do log pela sequência. Retorna 0 se o registro não existe ou já foi sobrescrito.
+//=======================================================================================================================
+uint8_t readLoggedSample(uint16_t sequence, PackedSample_t *sample)
+{
+    uint16_t offset, distance, rowSequence, rowsBack, page = __builtin_tblpage(sampleLog);
+    uint8_t rowIndex;
+
+    // Registros ainda na EEPROM
+    distance = sequence - getNextRowSequence();
+    if(distance < stagedRecords)
+        return(loadFromEEPROM((uint8_t *)sample, getStagedAddress(distance), sizeof(PackedSample_t)) != 0);
+
+    if(logEmpty)
+        return 0;
+
+    // As linhas têm sequências consecutivas, de SAMPLE_LOG_RECORDS_PER_ROW em SAMPLE_LOG_RECORDS_PER_ROW
+    distance = sequence - newestSequence;
+    if((int16_t)distance >= (int16_t)SAMPLE_LOG_RECORDS_PER_ROW)
+        return 0;
+    rowsBack = ((int16_t)distance >= 0) ? 0 : (((uint16_t)(newestSequence - sequence) + (SAMPLE_LOG_RECORDS_PER_ROW - 1)) / SAMPLE_LOG_RECORDS_PER_ROW);
+    if(rowsBack >= SAMPLE_LOG_ROWS)
+        return 0;
+
+    rowSequence = newestSequence - (rowsBack * SAMPLE_LOG_RECORDS_PER_ROW);
+    rowIndex = (newestRow + SAMPLE_LOG_ROWS - rowsBack) % SAMPLE_LOG_ROWS;
+    if(!isRowWritten(rowIndex) || flashReadWord(page, getLogOffset(rowIndex, 0)) != rowSequence)
+        return 0;
+
+    offset = getLogOffset(rowIndex, 1 + ((sequence - rowSequence) * RECORD_WORDS));
+    for(uint8_t word = 0; word < RECORD_WORDS; word++, offset += 2)
+        ((uint16_t *)sample)[word] = flashReadWord(page, offset);
+
+    return 1;
+}
+
+//***********************************************************************************************************************
\ No newline at end of file
@@ -0,0 +1,54 @@
+//***********************************************************************************************************************
+//                              Estante Irrigada - Sample Log
+//***********************************************************************************************************************
+#ifndef APPLICATION_SAMPLE_LOG
+#define	APPLICATION_SAMPLE_LOG
+
+#include <xc.h>
+#include "sensorHandling.h"
+
+//***********************************************************************************************************************
+// Definições
+//***********************************************************************************************************************
+#define SAMPLE_LOG_RECORDS_PER_FRAME    2   // Registros por quadro de descarga, dentro do MAX_PACKET_SIZE
+
+//***********************************************************************************************************************
+// Tipos de variáveis relacionadas ao registro de amostras
+//***********************************************************************************************************************
+//=======================================================================================================================
+// Faixa de registros disponíveis no log. As sequências são contínuas, de firstSequence a firstSequence + count - 1.
+//=======================================================================================================================
+typedef struct
+{
+    uint16_t        firstSequence;
+    uint16_t        count;
+} SampleLogInfo_t;
+
+//=======================================================================================================================
+// Pedido de descarga de uma faixa do log
+//=======================================================================================================================
+typedef struct
+{
+    uint16_t        firstSequence;
+    uint16_t        count;
+} SampleLogRequest_t;
+
+//=======================================================================================================================
+// Quadro de descarga. Leva registros consecutivos a partir de sequence; a quantidade vem do tamanho do pacote.
+//=======================================================================================================================
+typedef struct
+{
+    uint16_t        sequence;
+    PackedSample_t  record[SAMPLE_LOG_RECORDS_PER_FRAME];
+} SampleLogFrame_t;
+
+//***********************************************************************************************************************
+// Funções públicas do módulo
+//***********************************************************************************************************************
+extern void initSampleLog(void);
+extern void logSample(PackedSample_t *sample);
+extern void getSampleLogInfo(SampleLogInfo_t *info);
+extern uint8_t readLoggedSample(uint16_t sequence, PackedSample_t *sample);
+
+#endif /* APPLICATION_SAMPLE_LOG */
+//***********************************************************************************************************************
\ No newline at end of file
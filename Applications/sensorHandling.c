@@ -5,61 +5,399 @@
 #include "../Configuration/HardwareConfiguration.h"
 #include "../Peripherals/RTCC.h"
 #include "LoRaReception.h"
+#include "mainApplication.h"
+#include "sampleLog.h"
+#include "relay.h"
+#include "../Peripherals/EEPROM.h"
+#include "../Peripherals/timers.h"
 #include <libpic30.h>
 #include <string.h>
+#include <stddef.h>
 
 //=======================================================================================================================
-// Propriedades da aplicao pai que precisam ser acessadas neste mdulo
+// Propriedades da aplicação pai que precisam ser acessadas neste módulo
 //=======================================================================================================================
 extern controlConfig_t controlList[6];
 
 //=======================================================================================================================
-// Variveis privadas do mdulo
+// Tipos privados do módulo
+//=======================================================================================================================
+// Últimos valores enviados ao roteador. Ficam na EEPROM, já que a RAM é perdida no Deep Sleep.
+typedef struct
+{
+    uint16_t        value[MAX_SENSORS];
+    uint16_t        valveStates;        // Byte alto diferente de zero indica que não há registro (EEPROM apagada)
+} ReportState_t;
+
+// Acumuladores do resumo periódico. São mantidos na RAM e gravados no próximo slot da EEPROM, em rodízio, só quando uma
+// amostra entra nas estatísticas e, se o tempo de válvula mudou, antes do Deep Sleep. O número de sequência fica no
+// final para ser gravado por último: um slot com escrita interrompida mantém a sequência antiga e não é escolhido na
+// recuperação. lastSecond só vale dentro de um despertar.
+typedef struct
+{
+    uint32_t        sum[MAX_SENSORS];
+    uint16_t        periodStart;                // Minuto do dia em que o período começou. Inválido fora do dia.
+    uint16_t        count;
+    uint16_t        lastSecond;                 // Segundo da hora da última leitura, para o tempo de válvula ligada
+    uint16_t        min[MAX_SENSORS];
+    uint16_t        max[MAX_SENSORS];
+    uint16_t        valveOnSeconds[MAX_SENSORS];
+    uint16_t        sequence;
+} SummaryState_t;
+
+#define MINUTES_PER_DAY         1440
+#define SECONDS_PER_HOUR        3600
+#define SUMMARY_STATS           4               // Média, mínimo, máximo e último valor
+
+// Etapas da leitura dos sensores. As esperas são feitas entre passagens do loop principal, para que o rádio continue
+// sendo atendido.
+#define SENSOR_PHASE_IDLE       0
+#define SENSOR_PHASE_SETTLING   1               // Fonte dos sensores ligada, aguardando as saídas estabilizarem
+#define SENSOR_PHASE_SWITCHING  2               // Acionando as válvulas pedidas, uma por vez
+
+typedef char reportEEPROMSizeCheck[((REPORT_EEPROM_ADDRESS + sizeof(ReportState_t)) <= SUMMARY_EEPROM_ADDRESS) ? 1 : -1];
+typedef char summaryEEPROMSizeCheck[((SUMMARY_EEPROM_ADDRESS + (SUMMARY_SLOTS * sizeof(SummaryState_t))) <= SAMPLE_LOG_EEPROM_ADDRESS) ? 1 : -1];
+
+// O quadro de telemetria tem tamanho pré-acordado. Falha na compilação se PackedSample_t mudar de tamanho.
+typedef char telemetryFrameSizeCheck[(TELEMETRY_FRAME_SIZE == (1 + sizeof(PackedSample_t))) ? 1 : -1];
+
+// Atrás de um relay, todo quadro do módulo vai dentro do envelope EXT_RELAY
+typedef char relayedSampleSizeCheck[(sizeof(PackedSample_t) <= RELAY_INNER_PAYLOAD_SIZE) ? 1 : -1];
+typedef char relayedSummarySizeCheck[(sizeof(SummaryWaterFrame_t) <= RELAY_INNER_PAYLOAD_SIZE &&
+                                      sizeof(SummaryStatsFrame_t) <= RELAY_INNER_PAYLOAD_SIZE) ? 1 : -1];
+
+//=======================================================================================================================
+// Variáveis privadas do módulo
 //=======================================================================================================================
 static Sample_t actualSampling;
+static PackedSample_t packedSampling;
+static ReportState_t lastReport;
+static SummaryState_t summary;
+static uint8_t sampleUnconfirmed = 0, summaryChanged = 0;
+static uint8_t sensorPhase = SENSOR_PHASE_IDLE, rawSampleRequested = 0, rawSample = 0;
+static uint8_t valveRequests[MAX_SENSORS], valveRequestCount = 0, valveRequestIndex = 0, activeValves = 0, valvesOn = 0;
+static int16_t valveDeficit[MAX_SENSORS];
+static uint32_t phaseTick = 0;
 static IOPort_t ioSensorProcessing = {.ID = IO_UNDEFINED}, ioSensorEn = {.ID = IO_UNDEFINED};
 
 //***********************************************************************************************************************
-// Funes privadas
+// Funções privadas
 //***********************************************************************************************************************
 //=======================================================================================================================
-// Define o estado da fonte de alimentao dos sensores
+// Define o estado da fonte de alimentação dos sensores. Ao ligar, a leitura só pode ser feita SENSOR_SETTLE_MS depois,
+// o que fica a cargo da tarefa.
 //=======================================================================================================================
 static void setSensorSourceState(uint8_t state)
 {
     if(state)
+        writePin(ioSensorEn, PIN_ON);      // A fonte leva 80ns para ligar. Isto dá 1,28 TCY.
+    else
     {
-        writePin(ioSensorEn, PIN_ON);
-        __delay_ms(360);                   // A fonte leva 80ns para ligar. Isto d 1,28 TCY.
-                                           // No entanto, o MCP6N11 demora no mximo 360ms para ligar
-                                           // sua sada, portanto  necessrio aguardar este intervalo.
+        writePin(ioSensorEn, PIN_OFF);
+        __delay_us(10);                   // A fonte leva 200ns para desligar. Isto dá 3,2 TCY.
+                                          // No entanto, o MCP6N11 demora 10us para desligar suas saídas.
     }
+}
+
+//=======================================================================================================================
+// Define o estado ligado/desligado das válvulas. Todas as válvulas de uma porta são escritas de uma só vez.
+//=======================================================================================================================
+static void setValveStates(IOPortMask_t *valves)
+{
+    writePortMask(valves);
+    __delay32(3);               // Com 10mA para o acionamento das válvulas, leva-se
+                                // 90ns para o acionamento, que daria 1,44Tcy. Por segurança
+                                // mantém-se aqui 3Tcy para o acionamento, para não haver também
+                                // múltiplos acionamentos.
+                                // Limite máximo de corrente para todas as portas é de 200mA.
+}
+
+//=======================================================================================================================
+// Indica se um minuto do dia está dentro de uma janela de horário
+//=======================================================================================================================
+static uint8_t isInsideWindow(IrrigationWindow_t *window, uint16_t minuteOfDay)
+{
+    if(window->start <= window->end)
+        return(minuteOfDay >= window->start && minuteOfDay < window->end);
     else
+        return(minuteOfDay >= window->start || minuteOfDay < window->end);
+}
+
+//=======================================================================================================================
+// Indica se a válvula de um canal pode ser ligada pelo sensor no minuto do dia informado
+//=======================================================================================================================
+static uint8_t isIrrigationAllowed(uint8_t index, uint16_t minuteOfDay)
+{
+    return(isInsideWindow(&controlList[index].window, minuteOfDay) && !isInsideWindow(&controlList[index].blackout, minuteOfDay));
+}
+
+//=======================================================================================================================
+// Escalonador de válvulas. Ordena os pedidos de acionamento por déficit de umidade (o quanto a leitura está abaixo do
+// limite mínimo). As válvulas são ligadas depois, uma por passagem, por switchNextValve().
+//=======================================================================================================================
+static void scheduleValves(void)
+{
+    uint8_t request, position;
+
+    // Ordenação por inserção: são no máximo MAX_SENSORS pedidos
+    for(uint8_t index = 1; index < valveRequestCount; index++)
     {
-        writePin(ioSensorEn, PIN_OFF);
-        __delay_us(10);                   // A fonte leva 200ns para desligar. Isto d 3,2 TCY.
-                                          // No entanto, o MCP6N11 demora 10us para desligar suas sadas.
+        request = valveRequests[index];
+        for(position = index; position > 0 && valveDeficit[valveRequests[position - 1]] < valveDeficit[request]; position--)
+            valveRequests[position] = valveRequests[position - 1];
+        valveRequests[position] = request;
+    }
+    valveRequestIndex = 0;
+}
+
+//=======================================================================================================================
+// Liga a próxima válvula pedida, respeitando o número de válvulas ligadas ao mesmo tempo e o limite de corrente das
+// portas. Os acionamentos são espaçados de VALVE_STAGGER_MS, para que os picos de corrente não se somem. Retorna 0
+// quando não há mais o que ligar; os pedidos não atendidos ficam para a próxima leitura, quando alguma válvula pode ter
+// sido desligada.
+//=======================================================================================================================
+static uint8_t switchNextValve(void)
+{
+    IOPortMask_t valveUpdate;
+    uint8_t index;
+
+    if(valveRequestIndex >= valveRequestCount || activeValves >= VALVE_MAX_ACTIVE ||
+       ((activeValves + 1) * VALVE_DRIVE_CURRENT_MA) > PORT_CURRENT_BUDGET_MA)
+        return 0;
+
+    if(valveRequestIndex > 0 && (getTimerInterruptCount() - phaseTick) < VALVE_STAGGER_MS)
+        return 1;
+
+    index = valveRequests[valveRequestIndex++];
+    memset(&valveUpdate, 0, sizeof(IOPortMask_t));
+    setPinInMask(&valveUpdate, controlList[index].valvePin, PIN_ON);
+    setValveStates(&valveUpdate);
+    controlList[index].lastState = PIN_ON;
+    activeValves++;
+    phaseTick = getTimerInterruptCount();
+    return 1;
+}
+
+//=======================================================================================================================
+// Lê todos os sensores habilitados. A fonte dos sensores deve estar ligada há SENSOR_SETTLE_MS; ela é desligada em
+// seguida, para ficar ligada o menor tempo possível.
+//=======================================================================================================================
+static void readSensorValues(Sample_t *sample)
+{
+    for(int8_t index = 0; index < 6; index++)
+        sample->value[index] = (controlList[index].operation != CONTROL_DISABLED) ? getADCSample(controlList[index].sensorADC) : 0x0000;
+    setSensorSourceState(0);    // Desliga a fonte dos sensores
+}
+
+//=======================================================================================================================
+// Empacota valores de 10 bits em sequência, do bit menos significativo para o mais significativo. O buffer de destino
+// deve estar zerado.
+//=======================================================================================================================
+static void packTenBitValues(uint16_t *values, uint8_t count, uint8_t *packed)
+{
+    uint8_t bitPosition = 0, byteIndex;
+    uint16_t shiftedValue;
+
+    for(uint8_t index = 0; index < count; index++)
+    {
+        // Com deslocamentos de no máximo 6 bits, um valor de 10 bits sempre ocupa no máximo 2 bytes.
+        byteIndex = bitPosition >> 3;
+        shiftedValue = (values[index] & 0x03FF) << (bitPosition & 0x07);
+        packed[byteIndex] |= (uint8_t)shiftedValue;
+        packed[byteIndex + 1] |= (uint8_t)(shiftedValue >> 8);
+        bitPosition += 10;
+    }
+}
+
+//=======================================================================================================================
+// Compacta uma amostra para transmissão. Cada valor do ADC tem 10 bits, então os 6 valores cabem em 8 bytes, e os
+// estados das válvulas em um único byte. A amostra cai de 22 para 14 bytes.
+//=======================================================================================================================
+static void packSample(Sample_t *sample, PackedSample_t *packed)
+{
+    memset(packed, 0, sizeof(PackedSample_t));
+    packed->timestamp = sample->timestamp;
+    packed->nodeAddress = getNodeAddress();
+    packTenBitValues(sample->value, MAX_SENSORS, packed->packedValues);
+    for(uint8_t index = 0; index < MAX_SENSORS; index++)
+    {
+        if(sample->state[index] == PIN_ON)
+            packed->valveStates |= (1 << index);
+    }
+}
+
+//=======================================================================================================================
+// Envio por exceção: a amostra só é enviada se algum valor se afastou do último enviado mais que a sua banda morta,
+// se alguma válvula mudou de estado ou se chegou a hora do heartbeat. O heartbeat é alinhado ao minuto do dia, o
+// que dispensa guardar o horário do último envio. Entre envios, o roteador repete o último valor recebido.
+//=======================================================================================================================
+static uint8_t isReportRequired(Sample_t *sample, PackedSample_t *packed)
+{
+    uint16_t minuteOfDay, heartbeat = getHeartbeatInterval(), value, delta;
+
+    if((lastReport.valveStates & 0xFF00) || (lastReport.valveStates != packed->valveStates))
+        return 1;
+
+    for(uint8_t index = 0; index < MAX_SENSORS; index++)
+    {
+        value = sample->value[index] & 0x03FF;
+        delta = (value > lastReport.value[index]) ? (value - lastReport.value[index]) : (lastReport.value[index] - value);
+        if(delta > controlList[index].deadband)
+            return 1;
+    }
+
+    minuteOfDay = epochMinuteOfDay(sample->timestamp);
+    return((heartbeat <= 1) || ((minuteOfDay % heartbeat) == 0));
+}
+
+//=======================================================================================================================
+// Atualiza uma palavra do registro do último envio, gravando na EEPROM apenas se mudou
+//=======================================================================================================================
+static void updateReportWord(uint16_t *word, uint16_t value)
+{
+    if(*word != value)
+    {
+        *word = value;
+        saveToEEPROM((uint8_t *)word, REPORT_EEPROM_ADDRESS + ((uint8_t *)word - (uint8_t *)&lastReport), sizeof(uint16_t));
+    }
+}
+
+//=======================================================================================================================
+// Recupera os acumuladores do resumo: o slot válido com a sequência mais recente. Sem nenhum, começa do zero.
+//=======================================================================================================================
+static void loadSummary(void)
+{
+    uint16_t sequence, newest = 0, address;
+    uint8_t found = 0;
+
+    for(uint8_t slot = 0; slot < SUMMARY_SLOTS; slot++)
+    {
+        address = SUMMARY_EEPROM_ADDRESS + (slot * sizeof(SummaryState_t)) + offsetof(SummaryState_t, sequence);
+        sequence = eepromReadWord(address >> 1);
+        if((sequence % SUMMARY_SLOTS) == slot && (!found || (int16_t)(sequence - newest) > 0))
+        {
+            newest = sequence;
+            found = 1;
+        }
+    }
+
+    if(found)
+        loadFromEEPROM((uint8_t *)&summary, SUMMARY_EEPROM_ADDRESS + ((newest % SUMMARY_SLOTS) * sizeof(SummaryState_t)), sizeof(SummaryState_t));
+
+    if(!found || summary.periodStart >= MINUTES_PER_DAY)
+    {
+        memset(&summary, 0, sizeof(SummaryState_t));
+        summary.periodStart = MINUTES_PER_DAY;
+        summary.sequence = newest;
     }
+    summary.lastSecond = SECONDS_PER_HOUR;      // As válvulas estavam desligadas durante o Deep Sleep
 }
 
 //=======================================================================================================================
-// Define o estado ligado/desligado de uma vlvula
+// Grava os acumuladores no próximo slot do rodízio
 //=======================================================================================================================
-static void setValveState(IOPort_t valvePin, uint8_t state)
+static void saveSummary(void)
 {
-    writePin(valvePin, state);
-    __delay32(3);               // Com 10mA para o acionamento das vlvulas, leva-se
-                                // 90ns para o acionamento, que daria 1,44Tcy. Por segurana
-                                // mantm-se aqui 3Tcy para o acionamento, para no haver tambm
-                                // mltiplos acionamentos.
-                                // Limite mximo de corrente para todas as portas  de 200mA.
+    summary.sequence++;
+    saveToEEPROM((uint8_t *)&summary, SUMMARY_EEPROM_ADDRESS + ((summary.sequence % SUMMARY_SLOTS) * sizeof(SummaryState_t)), sizeof(SummaryState_t));
+    summaryChanged = 0;
+}
+
+//=======================================================================================================================
+// Envia o resumo do período, em duas partes. O último valor é o da amostra atual, que fecha o período. As duas partes
+// só são enviadas juntas: retorna 0, sem enviar nada, se não houver espaço para ambas na fila de transmissão.
+//=======================================================================================================================
+static uint8_t sendSummary(Sample_t *sample)
+{
+    SummaryWaterFrame_t water;
+    SummaryStatsFrame_t statsFrame;
+    uint16_t stats[MAX_SENSORS * SUMMARY_STATS], *channelStats = stats;
+
+    if(getTransmitQueueSpace() < 2)
+        return 0;
+
+    memset(&statsFrame, 0, sizeof(SummaryStatsFrame_t));
+    water.header.nodeAddress = getNodeAddress();
+    water.header.part = SUMMARY_PART_WATER;
+    water.header.periodStart = summary.periodStart;
+    statsFrame.header = water.header;
+    statsFrame.header.part = SUMMARY_PART_STATS;
+    statsFrame.sampleCount = (summary.count > 255) ? 255 : summary.count;
+    for(uint8_t index = 0; index < MAX_SENSORS; index++)
+    {
+        *channelStats++ = summary.sum[index] / summary.count;
+        *channelStats++ = summary.min[index];
+        *channelStats++ = summary.max[index];
+        *channelStats++ = sample->value[index];
+        water.valveOnSeconds[index] = summary.valveOnSeconds[index];
+    }
+    packTenBitValues(stats, MAX_SENSORS * SUMMARY_STATS, statsFrame.packedStats);
+    return(sendPacket(BROAD_COMMAND | CMD_SEND_SUMMARY, (unsigned char *)&water, sizeof(SummaryWaterFrame_t)) &&
+           sendPacket(BROAD_COMMAND | CMD_SEND_SUMMARY, (unsigned char *)&statsFrame, sizeof(SummaryStatsFrame_t)));
+}
+
+//=======================================================================================================================
+// Atualiza os acumuladores do resumo. Toda leitura contabiliza o tempo de válvula ligada: o intervalo desde a leitura
+// anterior é atribuído às válvulas que estavam ligadas nele. As estatísticas usam as amostras periódicas a cada
+// SUMMARY_SAMPLE_MINUTES, além da que fecha o período, e o resumo é enviado nesta, alinhado ao minuto do dia como o
+// heartbeat. A RAM é perdida no Deep Sleep, então cada amostra das estatísticas grava os acumuladores; com uma gravação
+// por minuto, a EEPROM se esgotaria em meses.
+//=======================================================================================================================
+static void updateSummary(Sample_t *sample, uint8_t valvesOn, uint8_t periodicSample)
+{
+    uint16_t secondOfHour, elapsed, minuteOfDay, value, period = getSummaryInterval();
+    uint8_t closing;
+
+    secondOfHour = epochSecondOfHour(sample->timestamp);
+    if(summary.lastSecond < SECONDS_PER_HOUR)
+    {
+        elapsed = (secondOfHour + SECONDS_PER_HOUR - summary.lastSecond) % SECONDS_PER_HOUR;
+        for(uint8_t index = 0; index < MAX_SENSORS; index++)
+        {
+            if(valvesOn & (1 << index))
+            {
+                summary.valveOnSeconds[index] = (summary.valveOnSeconds[index] > (0xFFFF - elapsed)) ? 0xFFFF : (summary.valveOnSeconds[index] + elapsed);
+                summaryChanged = 1;
+            }
+        }
+    }
+    summary.lastSecond = secondOfHour;
+
+    minuteOfDay = epochMinuteOfDay(sample->timestamp);
+    closing = (period != 0 && (minuteOfDay % period) == 0);
+    if(periodicSample && (closing || (minuteOfDay % SUMMARY_SAMPLE_MINUTES) == 0))
+    {
+        if(summary.periodStart >= MINUTES_PER_DAY)
+            summary.periodStart = minuteOfDay;
+
+        summary.count++;
+        for(uint8_t index = 0; index < MAX_SENSORS; index++)
+        {
+            value = sample->value[index] & 0x03FF;
+            summary.sum[index] += value;
+            if(summary.count == 1 || value < summary.min[index])
+                summary.min[index] = value;
+            if(summary.count == 1 || value > summary.max[index])
+                summary.max[index] = value;
+        }
+
+        // Sem crédito de tempo no ar, ou com a fila de transmissão cheia, o período se estende até o próximo fechamento
+        if(closing && isLowPriorityTrafficAllowed() && sendSummary(sample))
+        {
+            memset(summary.sum, 0, sizeof(summary.sum));
+            memset(summary.valveOnSeconds, 0, sizeof(summary.valveOnSeconds));
+            summary.count = 0;
+            summary.periodStart = minuteOfDay;
+        }
+        saveSummary();
+    }
 }
 
 //***********************************************************************************************************************
-// Funes pblicas
+// Funções públicas
 //***********************************************************************************************************************
 //=======================================================================================================================
-// Inicializao de variveis relacionadas com esta Tarefa
+// Inicialização de variáveis relacionadas com esta Tarefa
 //=======================================================================================================================
 void initTaskSensorHandling(uint16_t activityPinID, uint16_t enablePinID)
 {
@@ -68,77 +406,210 @@ void initTaskSensorHandling(uint16_t activityPinID, uint16_t enablePinID)
     ioSensorProcessing.ID = activityPinID;
     ioSensorEn.ID = enablePinID;
     memset(&actualSampling, 0, sizeof(Sample_t));
+    loadFromEEPROM((uint8_t *)&lastReport, REPORT_EEPROM_ADDRESS, sizeof(ReportState_t));
+    loadSummary();
     now.Time.seconds = intToBcd(0);
     now.Time.minutes = intToBcd(0);
     writeAlarmTime(&now);
 }
 
 //-----------------------------------------------------------------------------------------------------------------------
-// Tarefa principal desta aplicao, verificar os sensores ativos e atuar nas vlvulas relacionadas.
+// Tarefa principal desta aplicação, verificar os sensores ativos e atuar nas válvulas relacionadas. A leitura é feita
+// em etapas, sem esperas bloqueantes: a estabilização da fonte dos sensores e o espaçamento entre acionamentos de
+// válvulas passam entre passagens do loop principal, e o rádio continua sendo atendido nesse meio tempo.
 //-----------------------------------------------------------------------------------------------------------------------
 void taskSensorHandling(uint8_t *sendSamples, uint8_t *readSensors, uint8_t *valveActivated)
 {
-    if((*sendSamples != 0) || (*readSensors != 0))
+    uint8_t desiredState;
+    uint16_t minuteOfDay;
+    IOPortMask_t valveUpdate = {{0}, {0}};
+
+    if(sensorPhase == SENSOR_PHASE_IDLE)
     {
-        writePin(ioSensorProcessing, PIN_ON);          // Sinaliza verificao de sensores
-        readDateTime(&actualSampling.instant);         // L data/hora para os registros
+        if((*sendSamples == 0) && (*readSensors == 0) && !rawSampleRequested)
+            return;
+
+        writePin(ioSensorProcessing, PIN_ON);          // Sinaliza verificação de sensores
+        rawSample = rawSampleRequested;
+        rawSampleRequested = 0;
+        setSensorSourceState(1);                        // Liga a fonte dos sensores
+        phaseTick = getTimerInterruptCount();
+        sensorPhase = SENSOR_PHASE_SETTLING;
+    }
 
-        // Leitura dos sensores. A leitura  feita para todos os sensores, antes do processamento,
-        // para manter a fonte dos sensores ligada o menor tempo possvel.
-        setSensorSourceState(1);    // Liga a fonte dos sensores
-        for(int8_t index = 0; index < 6; index++)
-            actualSampling.value[index] = (controlList[index].operation != CONTROL_DISABLED) ? getADCSample(controlList[index].sensorADC) : 0x0000;
-        setSensorSourceState(0);    // Desliga a fonte dos sensores
+    if(sensorPhase == SENSOR_PHASE_SETTLING)
+    {
+        if((getTimerInterruptCount() - phaseTick) < SENSOR_SETTLE_MS)
+            return;
 
-        *valveActivated = 0;
-        
-        // Processamento das leituras, com os sensores desligados.
-        for(int8_t index = 0; index < 6; index++)
+        // Leitura dos sensores, antes do processamento
+        actualSampling.timestamp = readEpoch();        // Lê data/hora para os registros
+        readSensorValues(&actualSampling);
+        minuteOfDay = epochMinuteOfDay(actualSampling.timestamp);
+
+        // Válvulas ligadas desde a leitura anterior, para o tempo de válvula ligada do resumo
+        valvesOn = 0;
+        activeValves = 0;
+        valveRequestCount = 0;
+        for(uint8_t index = 0; index < MAX_SENSORS; index++)
+        {
+            if(controlList[index].lastState == PIN_ON)
+                valvesOn |= (1 << index);
+        }
+
+        // Processamento das leituras, com os sensores desligados. Os desligamentos são aplicados de uma vez; os pedidos
+        // de acionamento passam pelo escalonador de válvulas. Uma amostra bruta sozinha não atua nas válvulas.
+        for(uint8_t index = 0; index < MAX_SENSORS && ((*sendSamples != 0) || (*readSensors != 0)); index++)
         {
+            desiredState = PIN_OFF;
             if(controlList[index].operation == SENSOR_CONTROLS_VALVE)
             {
-                if(controlList[index].lastState == PIN_ON && actualSampling.value[index] > controlList[index].maxThreshold)
-                {
-                    setValveState(controlList[index].valvePin, PIN_OFF);
-                    actualSampling.state[index] = PIN_OFF;
-                    controlList[index].lastState = PIN_OFF;
-                }
-                if(controlList[index].lastState == PIN_OFF && actualSampling.value[index] < controlList[index].minThreshold)
-                {
-                    setValveState(controlList[index].valvePin, PIN_ON);
-                    actualSampling.state[index] = PIN_ON;
-                    controlList[index].lastState = PIN_ON;
-                }
-                
-                // Uma vlvula foi ativada, sinaliza isto para a aplicao.
-                if(controlList[index].lastState == PIN_ON)
-                {
-                    *valveActivated = 1;
-                }
+                if(!isIrrigationAllowed(index, minuteOfDay))
+                    desiredState = PIN_OFF;
+                else if(controlList[index].lastState == PIN_ON)
+                    desiredState = (actualSampling.value[index] > controlList[index].maxThreshold) ? PIN_OFF : PIN_ON;
+                else
+                    desiredState = (actualSampling.value[index] < controlList[index].minThreshold) ? PIN_ON : PIN_OFF;
+                valveDeficit[index] = (int16_t)controlList[index].minThreshold - (int16_t)actualSampling.value[index];
             }
             else if(controlList[index].operation == FORCE_VALVE_ON)
             {
-                setValveState(controlList[index].valvePin, PIN_ON);
-                actualSampling.state[index] = PIN_ON;
-                controlList[index].lastState = PIN_ON;
-                *valveActivated = 1;
+                desiredState = PIN_ON;
+                valveDeficit[index] = INT16_MAX;     // Acionamento forçado tem a maior prioridade
             }
-            else
+
+            // Válvulas que já estão no estado pedido não são regravadas
+            if(desiredState == PIN_OFF)
             {
-                setValveState(controlList[index].valvePin, PIN_OFF);
-                actualSampling.state[index] = PIN_OFF;
+                if(controlList[index].lastState != PIN_OFF)
+                    setPinInMask(&valveUpdate, controlList[index].valvePin, PIN_OFF);
                 controlList[index].lastState = PIN_OFF;
             }
+            else if(controlList[index].lastState == PIN_ON)
+                activeValves++;
+            else
+                valveRequests[valveRequestCount++] = index;
         }
+        setValveStates(&valveUpdate);
+
+        scheduleValves();
+        sensorPhase = SENSOR_PHASE_SWITCHING;
+    }
+
+    if(switchNextValve())
+        return;
 
-        // Envia um pacote de dados de amostras quando for requerido
+    for(uint8_t index = 0; index < MAX_SENSORS; index++)
+        actualSampling.state[index] = controlList[index].lastState;
+
+    if((*sendSamples != 0) || (*readSensors != 0))
+    {
+        // Uma válvula foi ativada, sinaliza isto para a aplicação.
+        *valveActivated = 0;
+        for(uint8_t index = 0; index < MAX_SENSORS; index++)
+        {
+            if(controlList[index].lastState == PIN_ON)
+                *valveActivated = 1;
+        }
+
+        updateSummary(&actualSampling, valvesOn, *sendSamples);
+
+        // Envia um pacote de dados de amostras quando for requerido. Sem crédito de tempo no ar, ou com a fila de
+        // transmissão cheia, a amostra vai direto para o log, de onde o roteador a busca depois.
         if(*sendSamples != 0)
-            sendPacket(BROAD_COMMAND | CMD_SEND_SAMPLES, ((unsigned char *)&actualSampling), sizeof(Sample_t));
- 
-        writePin(ioSensorProcessing, PIN_OFF);   // Finaliza a verificao de sensores
-        *sendSamples = 0;
-        *readSensors = 0;
+        {
+            packSample(&actualSampling, &packedSampling);
+            if(isReportRequired(&actualSampling, &packedSampling))
+            {
+                if(isLowPriorityTrafficAllowed() &&
+                   sendTelemetryPacket(BROAD_COMMAND | CMD_SEND_PACKED_SAMPLES, ((unsigned char *)&packedSampling)))
+                    sampleUnconfirmed = 1;
+                else
+                    logSample(&packedSampling);
+
+                for(uint8_t index = 0; index < MAX_SENSORS; index++)
+                    updateReportWord(&lastReport.value[index], actualSampling.value[index] & 0x03FF);
+                updateReportWord(&lastReport.valveStates, packedSampling.valveStates);
+            }
+        }
+    }
+
+    // Amostra bruta pedida pelo roteador, com a leitura feita agora. Com a fila de transmissão cheia, uma nova leitura
+    // é feita na próxima passagem.
+    if(rawSample)
+    {
+        packSample(&actualSampling, &packedSampling);
+        if(!sendTelemetryPacket(BROAD_COMMAND | CMD_SEND_PACKED_SAMPLES, ((unsigned char *)&packedSampling)))
+            rawSampleRequested = 1;
+        rawSample = 0;
+    }
+
+    writePin(ioSensorProcessing, PIN_OFF);   // Finaliza a verificação de sensores
+    *sendSamples = 0;
+    *readSensors = 0;
+    sensorPhase = SENSOR_PHASE_IDLE;
+}
+
+//=======================================================================================================================
+// Indica se há uma leitura de sensores em andamento, ou pedida. O módulo não deve dormir até que ela termine.
+//=======================================================================================================================
+uint8_t isSensorHandlingBusy(void)
+{
+    return(sensorPhase != SENSOR_PHASE_IDLE || rawSampleRequested);
+}
+
+//=======================================================================================================================
+// Fecha o ciclo de envio de amostras e do resumo antes do Deep Sleep. Uma amostra enviada sem CMD_UPLINK_ACK do
+// roteador, mesmo depois das retransmissões, é guardada no log. Outros quadros do roteador, como beacons, não contam
+// como entrega.
+//=======================================================================================================================
+void finishSampleCycle(void)
+{
+    if(sampleUnconfirmed && !isUplinkAcknowledged())
+        logSample(&packedSampling);
+    sampleUnconfirmed = 0;
+
+    // Tempo de válvula ligada acumulado neste despertar
+    if(summaryChanged)
+        saveSummary();
+}
+
+//=======================================================================================================================
+// Minutos até que algum canal controlado por sensor entre em horário de irrigação. Retorna 0 se algum já está, e
+// MINUTES_PER_DAY se nenhum canal depende do calendário. Um canal só passa a permitir irrigação no início da sua janela
+// ou no fim do seu bloqueio, então só estes instantes são verificados.
+//=======================================================================================================================
+uint16_t getMinutesToIrrigationWindow(uint16_t minuteOfDay)
+{
+    uint16_t minutes = MINUTES_PER_DAY, candidate[2], delta;
+
+    for(uint8_t index = 0; index < MAX_SENSORS; index++)
+    {
+        if(controlList[index].operation != SENSOR_CONTROLS_VALVE)
+            continue;
+        if(isIrrigationAllowed(index, minuteOfDay))
+            return 0;
+
+        candidate[0] = controlList[index].window.start % MINUTES_PER_DAY;
+        candidate[1] = controlList[index].blackout.end % MINUTES_PER_DAY;
+        for(uint8_t event = 0; event < 2; event++)
+        {
+            delta = (candidate[event] + MINUTES_PER_DAY - minuteOfDay) % MINUTES_PER_DAY;
+            if(delta != 0 && delta < minutes && isIrrigationAllowed(index, candidate[event]))
+                minutes = delta;
+        }
     }
+
+    return minutes;
+}
+
+//=======================================================================================================================
+// Pede uma amostra bruta, lida agora, a pedido do roteador. Ela é enviada por taskSensorHandling() assim que a fonte dos
+// sensores estabilizar. Sozinha, não atua nas válvulas nem entra no resumo.
+//=======================================================================================================================
+void sendRawSample(void)
+{
+    rawSampleRequested = 1;
 }
 
 //***********************************************************************************************************************
@@ -10,10 +10,10 @@
 #include "../Peripherals/IOPorts.h"
 
 //***********************************************************************************************************************
-// Definies
+// Definições
 //***********************************************************************************************************************
 //=======================================================================================================================
-// Tipos de habilitao
+// Tipos de habilitação
 //=======================================================================================================================
 #define CONTROL_DISABLED                0
 #define SENSOR_ENABLED                  1
@@ -22,20 +22,75 @@
 #define FORCE_VALVE_OFF                 4
 
 //***********************************************************************************************************************
-// Tipos de variveis relacionadas ao mdulo de gerenciamento de sensores
+// Tipos de variáveis relacionadas ao módulo de gerenciamento de sensores
 //***********************************************************************************************************************
 //=======================================================================================================================
-// Varivel de amostras
+// Variável de amostras
 //=======================================================================================================================
 typedef struct
 {
-    DateTime_t      instant;
+    uint32_t        timestamp;              // Segundos desde 01/01/1970
     uint16_t        value[6];
     uint8_t         state[6];
 } Sample_t;
 
 //=======================================================================================================================
-// Configurao dos sensores
+// Amostra compactada para transmissão. Os 6 valores de 10 bits são empacotados em sequência, do bit menos
+// significativo para o mais significativo, e os estados das válvulas ocupam um bit cada (bit n = válvula n).
+// É transmitida em um quadro de tamanho fixo, então o tamanho desta estrutura não pode mudar sem que o
+// TELEMETRY_FRAME_SIZE e o roteador sejam atualizados.
+//=======================================================================================================================
+typedef struct
+{
+    uint32_t        timestamp;              // Segundos desde 01/01/1970
+    uint8_t         packedValues[8];
+    uint8_t         valveStates;
+    uint8_t         nodeAddress;
+} PackedSample_t;
+
+//=======================================================================================================================
+// Resumo de estatísticas de um período, enviado em dois quadros CMD_SEND_SUMMARY, para caber no envelope EXT_RELAY.
+// O roteador junta as duas partes pelo endereço do módulo e pelo início do período.
+//=======================================================================================================================
+#define SUMMARY_PART_WATER          0
+#define SUMMARY_PART_STATS          1
+
+typedef struct
+{
+    uint8_t         nodeAddress;
+    uint8_t         part;                       // SUMMARY_PART_xxx
+    uint16_t        periodStart;                // Minuto do dia em que o período começou
+} SummaryHeader_t;
+
+// O tempo de válvula ligada, em segundos, dá o consumo de água de cada prateleira
+typedef struct
+{
+    SummaryHeader_t header;
+    uint16_t        valveOnSeconds[6];
+} SummaryWaterFrame_t;
+
+// Para cada sensor, média, mínimo, máximo e último valor das amostras do período são empacotados em 10 bits cada, na
+// mesma ordem de bits de PackedSample_t (sensor 0: média, mínimo, máximo, último; sensor 1: ...)
+typedef struct
+{
+    SummaryHeader_t header;
+    uint8_t         sampleCount;                // Amostras no período, saturado em 255
+    uint8_t         reserved;
+    uint8_t         packedStats[30];
+} SummaryStatsFrame_t;
+
+//=======================================================================================================================
+// Janela de horário, em minutos do dia. O fim não está incluído na janela; fim menor que o início indica uma janela
+// que passa da meia-noite, e início igual ao fim indica uma janela vazia.
+//=======================================================================================================================
+typedef struct
+{
+    uint16_t        start;
+    uint16_t        end;
+} IrrigationWindow_t;
+
+//=======================================================================================================================
+// Configuração dos sensores
 //=======================================================================================================================
 typedef struct
 {
@@ -45,12 +100,19 @@ typedef struct
     uint8_t         lastState;
     uint16_t        minThreshold;
     uint16_t        maxThreshold;
+    uint16_t        deadband;
+    IrrigationWindow_t window;                  // Horário em que a válvula pode ser ligada pelo sensor
+    IrrigationWindow_t blackout;                // Horário em que a válvula não pode ser ligada pelo sensor
 } controlConfig_t;
 
 //***********************************************************************************************************************
-// Funes pblicas do mdulo
+// Funções públicas do módulo
 //***********************************************************************************************************************
 extern void initTaskSensorHandling(uint16_t activityPinID, uint16_t enablePinID);
 extern void taskSensorHandling(uint8_t *sendSamples, uint8_t *readSensors, uint8_t *valveActivated);
+extern void sendRawSample(void);
+extern uint8_t isSensorHandlingBusy(void);
+extern void finishSampleCycle(void);
+extern uint16_t getMinutesToIrrigationWindow(uint16_t minuteOfDay);
 
 #endif /* APPLICATION_SENSOR_HANDLING */
\ No newline at end of file
@@ -0,0 +1,138 @@
+//***********************************************************************************************************************
+//                                         Time Synchronization
+//***********************************************************************************************************************
+#include "timeSync.h"
+#include "mainApplication.h"
+#include "../Configuration/HardwareConfiguration.h"
+#include "../Peripherals/RTCC.h"
+#include <xc.h>
+
+//***********************************************************************************************************************
+// Funções públicas
+//***********************************************************************************************************************
+//=======================================================================================================================
+// Inicialização do sincronismo. Reaplica o ajuste fino do RTCC, que initRTCC() zera. Após um Power-on Reset sem
+// horário válido, o RTCC parte de 01/01/2000 00:00:00 e passa a contar o tempo de espera por um beacon.
+//=======================================================================================================================
+void initTimeSync(uint8_t powerOnReset)
+{
+    setRTCCCalibration((int8_t)getTimeSyncState()->calibration);
+
+    if(powerOnReset && !isRTCCUpdated())
+        writeEpoch(EPOCH_2000);
+}
+
+//=======================================================================================================================
+// Aplica um horário confiável recebido do roteador: por beacon ou por resposta a um pedido, autenticados se a
+// autenticação estiver habilitada. O erro do RTCC é acumulado entre sincronismos, e depois de TIME_DRIFT_MIN_SECONDS
+// vira um novo ajuste fino: com 1 segundo de resolução na leitura, intervalos curtos dariam estimativas dominadas pelo
+// arredondamento.
+//=======================================================================================================================
+void applyTimeSync(uint32_t epoch)
+{
+    TimeSyncState_t state = *getTimeSyncState();
+    int32_t error, drift, elapsed;
+    int16_t calibration;
+
+    error = epochDelta(readEpoch(), epoch);
+    // As correções dos beacons não autenticados são descontadas, para que não entrem, nem escondam desvio, no ajuste fino
+    drift = error - state.openCorrection;
+    state.openCorrection = 0;
+
+    // Sem horário válido ou com erro grande demais, o RTCC foi zerado ou alterado, e o intervalo recomeça
+    if(!isRTCCUpdated() || state.driftReference == 0 || epoch <= state.driftReference ||
+       drift > TIME_DRIFT_MAX_ERROR || drift < -TIME_DRIFT_MAX_ERROR)
+    {
+        state.driftReference = epoch;
+        state.driftError = 0;
+    }
+    else
+    {
+        state.driftError += (int16_t)drift;
+        elapsed = (int32_t)(epoch - state.driftReference);
+        if(elapsed >= (int32_t)TIME_DRIFT_MIN_SECONDS)
+        {
+            if(state.driftError >= -TIME_DRIFT_MAX_ERROR && state.driftError <= TIME_DRIFT_MAX_ERROR)
+            {
+                // Cada unidade do ajuste vale 4 pulsos por minuto. RTCC adiantado (erro positivo) pede ajuste negativo.
+                calibration = state.calibration -
+                              (int16_t)((state.driftError * (int32_t)(RTCC_CLOCK_HZ * 60 / 4)) / elapsed);
+                if(calibration > 127)
+                    calibration = 127;
+                else if(calibration < -128)
+                    calibration = -128;
+                state.calibration = calibration;
+                setRTCCCalibration((int8_t)calibration);
+            }
+            state.driftReference = epoch;
+            state.driftError = 0;
+        }
+    }
+
+    // Regravar o RTCC sem necessidade desloca a fração de segundo em curso
+    if(error != 0)
+        writeEpoch(epoch);
+
+    state.lastSync = epoch;
+    saveTimeSyncState(&state);
+}
+
+//=======================================================================================================================
+// Aplica o horário de um beacon não autenticado, com a autenticação habilitada. O beacon pode ser forjado, então não
+// conta como sincronismo nem entra no ajuste fino: só corrige o RTCC em passos de até TIME_OPEN_STEP_MAX segundos, e em
+// até TIME_OPEN_CORRECTION_MAX segundos no total até o próximo sincronismo autenticado. Como lastSync não muda, o módulo
+// continua pedindo o horário ao roteador no prazo de isTimeRequestDue(). Retorna 1 se o RTCC foi corrigido.
+//=======================================================================================================================
+uint8_t applyOpenTimeSync(uint32_t epoch)
+{
+    TimeSyncState_t state = *getTimeSyncState();
+    int32_t correction, total;
+
+    if(!isRTCCUpdated() || state.lastSync == 0)
+        return 0;
+
+    correction = epochDelta(epoch, readEpoch());
+    total = state.openCorrection + correction;
+    if(correction == 0 || correction > TIME_OPEN_STEP_MAX || correction < -TIME_OPEN_STEP_MAX ||
+       total > TIME_OPEN_CORRECTION_MAX || total < -TIME_OPEN_CORRECTION_MAX)
+        return 0;
+
+    writeEpoch(epoch);
+    state.openCorrection = (int16_t)total;
+    saveTimeSyncState(&state);
+    return 1;
+}
+
+//=======================================================================================================================
+// Indica se o módulo deve pedir o horário diretamente ao roteador, por ter perdido beacons demais. Os pedidos da
+// rede são espalhados pelo endereço do nó, para que uma falta de energia não gere uma rajada de pedidos na volta.
+//=======================================================================================================================
+uint8_t isTimeRequestDue(void)
+{
+    uint32_t now = readEpoch(), since, offset = (uint32_t)(getNodeAddress() % TIME_REQUEST_SPREAD) * WAKE_INTERVAL_SECONDS;
+
+    if(now >= EPOCH_2024)
+    {
+        since = now - getTimeSyncState()->lastSync;
+        return(since >= (((uint32_t)TIME_BEACON_INTERVAL * TIME_BEACON_MISSES) + offset));
+    }
+
+    // Sem horário válido, o RTCC conta o tempo desde o Power-on Reset (ver initTimeSync()) e o módulo desperta a
+    // cada WAKE_INTERVAL_SECONDS. Vencida a espera, o pedido é repetido a cada TIME_REQUEST_SPREAD despertares.
+    since = now - EPOCH_2000;
+    if(since < (TIME_UNSYNCED_WAIT + offset))
+        return 0;
+    return((((since - TIME_UNSYNCED_WAIT - offset) / WAKE_INTERVAL_SECONDS) % TIME_REQUEST_SPREAD) == 0);
+}
+
+//=======================================================================================================================
+// Início da janela de transmissão do módulo, em milissegundos após o início do minuto
+//=======================================================================================================================
+uint16_t getUplinkSlotOffset(void)
+{
+    UplinkSlot_t *slot = getUplinkSlot();
+
+    return (uint16_t)(((uint32_t)slot->index * slot->lengthMs) % 60000UL);
+}
+
+//***********************************************************************************************************************
\ No newline at end of file
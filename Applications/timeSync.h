@@ -0,0 +1,44 @@
+//***********************************************************************************************************************
+//                              Estante Irrigada - Time Synchronization
+//***********************************************************************************************************************
+#ifndef APPLICATION_TIME_SYNC
+#define	APPLICATION_TIME_SYNC
+
+#include <xc.h>
+
+//***********************************************************************************************************************
+// Tipos de variáveis relacionadas ao módulo de sincronismo de horário
+//***********************************************************************************************************************
+//=======================================================================================================================
+// Estado do sincronismo, guardado na configuração não volátil. Instantes em segundos desde 01/01/1970.
+//=======================================================================================================================
+typedef struct
+{
+    uint32_t        lastSync;           // Último horário recebido do roteador
+    uint32_t        driftReference;     // Início do intervalo de estimativa do desvio do RTCC. Zero se não houver.
+    int16_t         driftError;         // Erro acumulado do RTCC desde driftReference, em segundos
+    int16_t         calibration;        // Ajuste fino aplicado ao RTCC (RCFGCAL.CAL)
+    int16_t         openCorrection;     // Correções feitas por beacons não autenticados desde o último sincronismo
+} TimeSyncState_t;
+
+//=======================================================================================================================
+// Janela de transmissão do módulo, atribuída pelo roteador. O início da janela, em milissegundos após o início do
+// minuto, é index * lengthMs. Com lengthMs zero, não há janela atribuída e o módulo transmite no início do minuto.
+//=======================================================================================================================
+typedef struct
+{
+    uint16_t        index;
+    uint16_t        lengthMs;
+} UplinkSlot_t;
+
+//***********************************************************************************************************************
+// Funções públicas do módulo
+//***********************************************************************************************************************
+extern void initTimeSync(uint8_t powerOnReset);
+extern void applyTimeSync(uint32_t epoch);
+extern uint8_t applyOpenTimeSync(uint32_t epoch);
+extern uint8_t isTimeRequestDue(void);
+extern uint16_t getUplinkSlotOffset(void);
+
+#endif /* APPLICATION_TIME_SYNC */
+//***********************************************************************************************************************
\ No newline at end of file
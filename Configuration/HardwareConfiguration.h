@@ -1,5 +1,5 @@
 //***********************************************************************************************************************
-//                              Estante Irrigada - Definio de pinosz
+//                              Estante Irrigada - Definição de pinosz
 //***********************************************************************************************************************
 #ifndef IO_PIN_DEFINITIONS
 #define	IO_PIN_DEFINITIONS
@@ -8,22 +8,134 @@
 #include "../Peripherals/ADC.h"
 
 //***********************************************************************************************************************
-// Configuraes de Hardware
+// Configurações de Hardware
 //***********************************************************************************************************************
-#define FCY                     16000000    // Frequncia das instrues = FCLOCK / 2
-#define APPLICATION_TIME_OUT    2000        // Fica no mximo 1000ms (1s) ligado
+#define FCY                     16000000    // Frequência das instruções = FCLOCK / 2
+#define APPLICATION_TIME_OUT    2000        // Fica no máximo 1000ms (1s) ligado
+#define WAKE_INTERVAL_SECONDS   10          // Intervalo entre alarmes do RTCC enquanto há válvulas ligadas ou o RTCC não
+                                            // está atualizado. Fora disso, o alarme segue o calendário de irrigação.
 #define MAX_SENSORS             6
 
 //***********************************************************************************************************************
-// Configuraes de Comunicao
+// Mapa da EEPROM
+//***********************************************************************************************************************
+#define EEPROM_SIZE             512
+#define CONFIG_EEPROM_ADDRESS   2           // Configuração não volátil. O endereço 0 guarda o identificador.
+#define AUTH_EEPROM_ADDRESS     200         // Chave de autenticação e contador do último comando aceito (authentication)
+#define OTA_EEPROM_ADDRESS      232         // Estado da atualização de firmware (firmwareUpdate), para o bootloader
+#define REPORT_EEPROM_ADDRESS   256         // Últimos valores reportados ao roteador (sensorHandling)
+#define SUMMARY_EEPROM_ADDRESS  272         // Acumuladores do resumo periódico, em SUMMARY_SLOTS cópias (sensorHandling)
+#define SUMMARY_SLOTS           3           // Cópias dos acumuladores, gravadas em rodízio para distribuir o desgaste
+#define SAMPLE_LOG_EEPROM_ADDRESS 476       // Registros do log de amostras que ainda não completam uma linha da Flash
+
+//***********************************************************************************************************************
+// Configurações de Comunicação
 //***********************************************************************************************************************
 #define MAX_PACKET_SIZE    50
+#define TELEMETRY_FRAME_SIZE    15          // Quadro de amostras com cabeçalho implícito: comando + PackedSample_t.
+                                            // Tamanho pré-acordado com o roteador.
+#define MODEM_CONFIG_TRIALS     6           // Despertares com uma nova configuração de modem, sem ouvir o roteador,
+                                            // antes de voltar para a última configuração confirmada
+#define RX_WINDOW_DELAY_MS      100         // Atraso entre o fim de uma transmissão e a abertura da janela de recepção.
+                                            // O roteador deve transmitir neste instante.
+#define RX_WINDOW_SYMBOLS       24          // Duração da janela de recepção, em símbolos (REG_SYMB_TIMEOUT)
+#define UPLINK_ACK_GUARD_MS     200         // Espera pela confirmação de uma amostra, além do tempo no ar dela
+#define UPLINK_MAX_RETRIES      2           // Retransmissões de uma amostra sem confirmação. A espera dobra a cada uma.
+#define UPLINK_BACKOFF_JITTER_MS 20         // Espera adicional por endereço do nó, para separar retransmissões
+#define REPLAY_CACHE_SIZE       4           // Respostas guardadas para comandos repetidos pelo roteador
+#define REPLAY_RESPONSE_SIZE    40          // Tamanho máximo de uma resposta guardada (comando + payload)
+#define TX_QUEUE_SIZE           4           // Quadros aguardando transmissão. Com a fila cheia, o envio é recusado.
+#define LINK_MISSES_PER_STEP    3           // Despertares sem ouvir o roteador para cada degrau de aumento do enlace
+#define LINK_TX_POWER_STEP      3           // Aumento de potência, em dB, a cada degrau
+#define LINK_MAX_TX_POWER       17          // Potência máxima alcançada automaticamente. Acima disso, aumenta-se o SF.
+
+//***********************************************************************************************************************
+// Limite de ocupação do canal (duty cycle)
+//***********************************************************************************************************************
+#define AIRTIME_DUTY_PERCENT    1           // Ocupação máxima do canal permitida pela regulamentação
+#define AIRTIME_WINDOW_SECONDS  3600        // Janela de apuração do duty cycle
+#define AIRTIME_BUDGET_MS       ((uint16_t)(AIRTIME_WINDOW_SECONDS * 10UL * AIRTIME_DUTY_PERCENT))
+#define AIRTIME_LOW_PRIORITY_RESERVE_MS (AIRTIME_BUDGET_MS / 4)   // Abaixo disto, só ACKs e respostas são enviados
+
+//***********************************************************************************************************************
+// Envio de amostras por exceção
+//***********************************************************************************************************************
+#define DEFAULT_DEADBAND        8           // Variação do ADC, em relação ao último valor enviado, que gera um envio
+#define DEFAULT_HEARTBEAT       15          // Intervalo máximo entre envios, em minutos
+#define DEFAULT_SAMPLE_PERIOD   1           // Intervalo entre leituras fora das janelas de irrigação, em minutos. Também
+                                            // limita a espera por downlinks, que só são ouvidos após um envio.
+#define DEFAULT_SUMMARY_PERIOD  60          // Período do resumo de estatísticas, em minutos. Zero desabilita os resumos.
+#define SUMMARY_SAMPLE_MINUTES  10          // Intervalo, em minutos do dia, das amostras que entram nas estatísticas do
+                                            // resumo. Cada uma grava os acumuladores na EEPROM: com SUMMARY_SLOTS
+                                            // cópias, 10 minutos dão 48 gravações por dia em cada célula.
+#define SAMPLE_LOG_ROWS         8           // Linhas da Flash reservadas para o log de amostras não entregues
+
+//***********************************************************************************************************************
+// Acionamento das válvulas
+//***********************************************************************************************************************
+#define VALVE_MAX_ACTIVE        3           // Válvulas ligadas ao mesmo tempo, para não derrubar a alimentação
+#define VALVE_DRIVE_CURRENT_MA  10          // Corrente drenada das portas por válvula ligada
+#define PORT_CURRENT_BUDGET_MA  200         // Limite de corrente somado de todas as portas do microcontrolador
+#define VALVE_STAGGER_MS        50          // Intervalo entre acionamentos consecutivos de válvulas
+#define SENSOR_SETTLE_MS        360         // Espera entre ligar a fonte dos sensores e a leitura: o MCP6N11 demora no
+                                            // máximo 360ms para ligar sua saída
+
+//***********************************************************************************************************************
+// Encaminhamento por relays
+//***********************************************************************************************************************
+#define RELAY_MAX_HOPS          3           // Saltos máximos entre um módulo e o roteador
+#define RELAY_ROUTE_TABLE_SIZE  8           // Caminhos de volta guardados por um relay
+#define RELAY_RECENT_FRAMES     8           // Quadros lembrados para o descarte de duplicatas
+#define RELAY_DUPLICATE_MS      3000        // Tempo em que um quadro é lembrado. Menor que o intervalo entre despertares.
+#define RELAY_ADVERTISE_INTERVAL_MS 60000UL // Intervalo entre anúncios de um relay
+#define RELAY_ADVERTISE_SLOT_MS 50          // Espaçamento, por endereço, das respostas a um pedido de anúncio
+#define RELAY_DISCOVERY_WINDOW_MS 1000      // Espera pelos anúncios depois de um pedido
+#define RELAY_HOP_PENALTY       12          // Custo de cada salto na escolha do pai, em quartos de dB de SNR
+#define RELAY_PARENT_HYSTERESIS 8           // Vantagem mínima, em quartos de dB, para trocar de pai
+#define RELAY_HOP_DELAY_MS      300         // Espera adicional pela confirmação de uma amostra, por salto em cada sentido
+
+//***********************************************************************************************************************
+// Atualização de firmware
+//***********************************************************************************************************************
+#define FIRMWARE_VERSION        0x0100      // Versão desta imagem. Os patches são gerados sobre uma versão específica.
+#define OTA_STAGE_ROWS          8           // Linhas da Flash reservadas para receber o patch
+#define OTA_BLOCK_SIZE          32          // Bytes do patch por quadro EXT_OTA_BLOCK
+#define OTA_SESSION_TIMEOUT_MS  5000        // Sem quadros da atualização por este tempo, o módulo volta ao ciclo normal
+
+//***********************************************************************************************************************
+// Autenticação
+//***********************************************************************************************************************
+#define AUTH_PROVISION_WINDOW_MS 60000UL    // Após um Power-on Reset, prazo para gravar a primeira chave. Exige acesso
+                                            // físico ao módulo para religá-lo.
+
+//***********************************************************************************************************************
+// Sincronismo de horário
+//***********************************************************************************************************************
+#define TIME_BEACON_INTERVAL    3600        // Intervalo entre beacons de horário do roteador, em segundos
+#define TIME_BEACON_MISSES      3           // Beacons perdidos antes de pedir o horário diretamente ao roteador
+#define TIME_UNSYNCED_WAIT      300         // Sem horário válido, espera por um beacon, em segundos, antes de pedir
+                                            // o horário diretamente ao roteador
+#define MULTICAST_WINDOW_SECOND 50          // Nos minutos alinhados a TIME_BEACON_INTERVAL, segundo em que o roteador
+                                            // começa a enviar beacons, comandos de grupo e blocos de OTA. Os módulos
+                                            // acordam e escutam até o fim da janela; suas janelas de transmissão devem
+                                            // ficar antes dela.
+#define MULTICAST_WINDOW_SECONDS 8          // Duração da escuta programada, em segundos
+#define TIME_REQUEST_SPREAD     6           // Pedidos de horário da rede espalhados por este número de despertares,
+                                            // conforme o endereço do nó
+#define TIME_DRIFT_MIN_SECONDS  21600UL     // Intervalo mínimo entre sincronismos para estimar o desvio do RTCC
+#define TIME_DRIFT_MAX_ERROR    600         // Erros maiores que isto, em segundos, não são desvio: o horário foi
+                                            // perdido ou alterado
+#define RTCC_CLOCK_HZ           31000UL     // Relógio do RTCC (LPRC, conforme RTCOSC)
+#define TIME_OPEN_STEP_MAX      2           // Com a autenticação habilitada, maior correção, em segundos, feita por um
+                                            // beacon não autenticado
+#define TIME_OPEN_CORRECTION_MAX 30         // Correção total, em segundos, feita por beacons não autenticados entre
+                                            // dois sincronismos autenticados
 
 //***********************************************************************************************************************
-// Definio de nome de pinos
+// Definição de nome de pinos
 //***********************************************************************************************************************
 //=======================================================================================================================
-// Definies de pinos gerais
+// Definições de pinos gerais
 //=======================================================================================================================
 #define LED             IO_B4
 #define SENSOR_EN       IO_A6
@@ -35,7 +147,7 @@
 #define LORA_CLK        IO_B11
 
 //=======================================================================================================================
-// Definies de pinos de controle das vlvulas
+// Definições de pinos de controle das válvulas
 //=======================================================================================================================
 #define VALVULA0        IO_B14
 #define VALVULA1        IO_B12
@@ -45,7 +157,7 @@
 #define VALVULA5        IO_B7
 
 //=======================================================================================================================
-// Definies de pinos leitura dos sensores
+// Definições de pinos leitura dos sensores
 //=======================================================================================================================
 #define SENSOR0         IO_A0
 #define SENSOR0_ADC     ADC_0
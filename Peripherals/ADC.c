@@ -1,5 +1,5 @@
 //***********************************************************************************************************************
-//                                         Mdulo de ADC
+//                                         Módulo de ADC
 //***********************************************************************************************************************
 #include "../Configuration/HardwareConfiguration.h"
 #include <xc.h>
@@ -8,23 +8,23 @@
 #include <p24F16KA102.h>
 
 //***********************************************************************************************************************
-// Definies internas
+// Definições internas
 //***********************************************************************************************************************
 #define NUM_OF_ADCS     9
 
 //***********************************************************************************************************************
-// Variveis privadas do mdulo
+// Variáveis privadas do módulo
 //***********************************************************************************************************************
 static const uint8_t adcList[NUM_OF_ADCS] = {ADC_0, ADC_1, ADC_2, ADC_3, ADC_4, ADC_5, ADC_10, ADC_11, ADC_12};
 static uint16_t calibrationValue[NUM_OF_ADCS];
 
 //***********************************************************************************************************************
-// Interrupes
+// Interrupções
 //***********************************************************************************************************************
 //=======================================================================================================================
-// Interrupo do ADC
-// Descrio: O vetor de interrupo do ADC pode ser usado para executar algum cdigo aps a converso
-//            Ainda no est implementado o chamado a uma funo de callback.
+// Interrupção do ADC
+// Descrição: O vetor de interrupção do ADC pode ser usado para executar algum código após a conversão
+//            Ainda não está implementado o chamado a uma função de callback.
 //=======================================================================================================================
 void _ISR __attribute__((no_auto_psv)) _ADC1Interrupt(void)
 {
@@ -32,7 +32,7 @@ void _ISR __attribute__((no_auto_psv)) _ADC1Interrupt(void)
 }
 
 //***********************************************************************************************************************
-// Funes privadas
+// Funções privadas
 //***********************************************************************************************************************
 //=======================================================================================================================
 // Seleciona um canal de ADC
@@ -47,7 +47,7 @@ static void selectADChannel(adcChannel_t channel)
 }
 
 //=======================================================================================================================
-// Define o valor padro de calibrao de um ADC
+// Define o valor padrão de calibração de um ADC
 //=======================================================================================================================
 static void setADCCalibrationValue(adcChannel_t channel, uint16_t value)
 {
@@ -58,7 +58,7 @@ static void setADCCalibrationValue(adcChannel_t channel, uint16_t value)
 }
 
 //=======================================================================================================================
-// L o valor padro de calibrao de um ADC
+// Lê o valor padrão de calibração de um ADC
 //=======================================================================================================================
 static uint16_t getADCCalibrationValue(adcChannel_t channel)
 {
@@ -77,33 +77,33 @@ static uint16_t getADCCalibrationValue(adcChannel_t channel)
 //=======================================================================================================================
 static void calibrateADCs(void)
 {
-    AD1CON2bits.OFFCAL = 1;  // Inicializa o modo de calibrao
+    AD1CON2bits.OFFCAL = 1;  // Inicializa o modo de calibração
     for(uint8_t index = 0; index <= NUM_OF_ADCS; index++)
         setADCCalibrationValue(adcList[index], getADCSample(adcList[index]));
-    AD1CON2bits.OFFCAL = 0;  // Finaliza o modo de calibrao
+    AD1CON2bits.OFFCAL = 0;  // Finaliza o modo de calibração
 }
 
 //***********************************************************************************************************************
-// Funes pblicas
+// Funções públicas
 //***********************************************************************************************************************
 //=======================================================================================================================
-// Inicializao do mdulo principal de ADC
+// Inicialização do módulo principal de ADC
 //=======================================================================================================================
 void initADCs(void)
 {
-    AD1CON1 = 0x0000;       // SAMP bit = 0 indica fim da amostragem e incio da converso, mas aqui o mdulo no 
-                            // est ligado ainda
+    AD1CON1 = 0x0000;       // SAMP bit = 0 indica fim da amostragem e início da conversão, mas aqui o módulo não 
+                            // está ligado ainda
     AD1CHS = 0x0000;        // Selecionando canal 0
-    AD1CSSL = 0;            // No haver varredura na leitura das portas analgicas.
+    AD1CSSL = 0;            // Não haverá varredura na leitura das portas analógicas.
     AD1CON3 = 0x0001;       // Manual Sample, Tad = 2Tcy
-    AD1CON2 = 0x0000;       // Usando as referncias de tenso analgica internas. No sero usadas interrupes aqui.
+    AD1CON2 = 0x0000;       // Usando as referências de tensão analógica internas. Não serão usadas interrupções aqui.
     AD1CON1bits.ADON = 1;   // Liga o ADC
     
     calibrateADCs();
 }
 
 //=======================================================================================================================
-// Define um pino como analgico ou digital
+// Define um pino como analógico ou digital
 //=======================================================================================================================
 void setupADCPinState(adcChannel_t channel, uint8_t state)
 {
@@ -118,24 +118,37 @@ void setupADCPinState(adcChannel_t channel, uint8_t state)
 }
 
 //=======================================================================================================================
-// Processa uma lista de configuraes de ADC
+// Processa uma lista de configurações de ADC
 //=======================================================================================================================
 void setupADCPinStateList(const ADCSetup_t *list, uint8_t size)
 {
+    uint16_t usedPins = 0, digitalPins = 0, pinMask;
+
+    // A lista é convertida em uma máscara, e AD1PCFG é escrito uma única vez. Como na aplicação item a item, uma
+    // entrada posterior prevalece sobre as anteriores para o mesmo pino.
     for(uint8_t index=0; index < size; index++)
-        setupADCPinState(list[index].channel, list[index].adstate);
+    {
+        pinMask = (list[index].channel == ADC_ALL) ? 0xFFFF : (1 << list[index].channel);
+        usedPins |= pinMask;
+        if(list[index].adstate == PIN_DIGITAL)
+            digitalPins |= pinMask;
+        else
+            digitalPins &= ~pinMask;
+    }
+
+    AD1PCFG = (AD1PCFG & ~usedPins) | digitalPins;
 }
 
 //=======================================================================================================================
-// Obtm uma amostra do ADC
+// Obtém uma amostra do ADC
 //=======================================================================================================================
 uint16_t getADCSample(adcChannel_t channel)
 {
     selectADChannel(channel);
     AD1CON1bits.SAMP = 1;       // Inicia a amostragem no conversor AD
-    __delay32(6);               // Aguarda 3 TAD, que  o tempo mximo de amostragem segundo o datasheet
-    AD1CON1bits.SAMP = 0;       // Termina a amostragem, entrando automaticamente no perodo de converso
-    while(!AD1CON1bits.DONE);   // Aguarda o fim da converso;
+    __delay32(6);               // Aguarda 3 TAD, que é o tempo máximo de amostragem segundo o datasheet
+    AD1CON1bits.SAMP = 0;       // Termina a amostragem, entrando automaticamente no período de conversão
+    while(!AD1CON1bits.DONE);   // Aguarda o fim da conversão;
     return(ADC1BUF0 - getADCCalibrationValue(channel));
 }
 
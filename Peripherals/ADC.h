@@ -21,13 +21,13 @@
 #define ADC_ALL         0xFF
 
 //***********************************************************************************************************************
-// Outras definies
+// Outras definições
 //***********************************************************************************************************************
 #define PIN_DIGITAL     1
 #define PIN_ANALOG      0
 
 //***********************************************************************************************************************
-// Tipos de variveis relacionadas ao mdulo de ADC
+// Tipos de variáveis relacionadas ao módulo de ADC
 //***********************************************************************************************************************
 typedef uint8_t adcChannel_t;
 typedef struct
@@ -37,7 +37,7 @@ typedef struct
 } ADCSetup_t;
 
 //***********************************************************************************************************************
-// Funes pblicas do mdulo
+// Funções públicas do módulo
 //***********************************************************************************************************************
 extern void initADCs(void);
 extern void setupADCPinState(adcChannel_t channel, uint8_t state);
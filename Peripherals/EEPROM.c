@@ -1,70 +1,178 @@
 //***********************************************************************************************************************
-//                                         Mdulo de EEPROM
+//                                         Módulo de EEPROM
 //***********************************************************************************************************************
 #include "../Configuration/HardwareConfiguration.h"
 #include <xc.h>
 
 //***********************************************************************************************************************
-// Definies internas
+// Definições internas
 //***********************************************************************************************************************
 #define CONFIG_SAVED_ID           0x4353
+#define EEPROM_QUEUE_SIZE         32        // Palavras aguardando gravação
 
+#define TurnNVMInterruptOff()     _NVMIE = 0;
+#define TurnNVMInterruptOn()      _NVMIE = 1;
+
+//***********************************************************************************************************************
+// Tipos privados do módulo
 //***********************************************************************************************************************
-// Variveis privadas do mdulo
+typedef struct
+{
+    uint16_t        index;
+    uint16_t        data;
+} EEPROMWrite_t;
+
+//***********************************************************************************************************************
+// Variáveis privadas do módulo
 //***********************************************************************************************************************
 static int __attribute__ ((space(eedata))) eeData = 0x1234;;
 uint8_t teste[5] = {0x01, 0x02, 0x03, 0x04, 0x05};
 uint8_t teste2[5];
 
+// Fila de gravação. A palavra no início da fila é a que está sendo gravada; enquanto houver palavras na fila, há uma
+// gravação em andamento.
+static EEPROMWrite_t writeQueue[EEPROM_QUEUE_SIZE];
+static volatile uint8_t queueHead = 0, queueCount = 0;
+
 //***********************************************************************************************************************
-// Funes pblicas
+// Funções privadas
 //***********************************************************************************************************************
+//=======================================================================================================================
+// Inicia a gravação da palavra no início da fila, sem aguardar. O término é tratado na interrupção da NVM.
+//=======================================================================================================================
+static void startQueuedWrite(void)
+{
+    uint16_t offset;
+
+    NVMCON = 0x4004;                         // Configura NVMCON para escrever uma palavra
+    TBLPAG = __builtin_tblpage(&eeData);     // Inicializa TBLPAG com o endeereço superior
+    offset = __builtin_tbloffset(&eeData);   // Obtém o endereço inferior base
+    offset += writeQueue[queueHead].index * sizeof(uint16_t);
+    __builtin_tblwtl(offset, writeQueue[queueHead].data);
+    asm volatile ("disi #5");                // Desabilita interrupções por 5 instruções
+    __builtin_write_NVM();                   // Desbloqueia EEPROM para alterações e executa o comando
+}
+
+//***********************************************************************************************************************
+// Interrupções
+//***********************************************************************************************************************
+//=======================================================================================================================
+// Interrupção da NVM
+// Descrição: Fim de uma gravação. Retira a palavra gravada da fila e inicia a próxima. As operações síncronas
+//            (apagamentos e Flash) só ocorrem com a fila vazia, e também geram esta interrupção, que então é ignorada.
+//=======================================================================================================================
+void _ISR __attribute__((no_auto_psv)) _NVMInterrupt(void)
+{
+    uint16_t savedPage = TBLPAG;    // A interrupção pode ocorrer no meio de uma leitura de tabela do programa principal
+
+    _NVMIF = 0;
+    if(queueCount != 0)
+    {
+        queueHead = (queueHead + 1) % EEPROM_QUEUE_SIZE;
+        queueCount--;
+        if(queueCount != 0)
+            startQueuedWrite();
+    }
+    TBLPAG = savedPage;
+}
+
+//***********************************************************************************************************************
+// Funções públicas
+//***********************************************************************************************************************
+//=======================================================================================================================
+// Aguarda o fim de todas as gravações pendentes. Necessário antes do Deep Sleep e de operações síncronas na NVM.
+//=======================================================================================================================
+void eepromFlush(void)
+{
+    while(queueCount != 0);
+}
+
 //=======================================================================================================================
 // Apaga toda a EEPROM
 //=======================================================================================================================
 void eepromBulkErase(void)
 {
-    NVMCON = 0x4050;            // Configura NVMCOM para apagar toda a memria
-    asm volatile ("disi #5");   // Desabilita interrupes por 5 instrues
-    __builtin_write_NVM();      // Desbloqueia EEPROM para alteraes e executa o comando
+    eepromFlush();
+    NVMCON = 0x4050;            // Configura NVMCOM para apagar toda a memória
+    asm volatile ("disi #5");   // Desabilita interrupções por 5 instruções
+    __builtin_write_NVM();      // Desbloqueia EEPROM para alterações e executa o comando
     while(_WR);                 // Aguarda o apagamento
 }
 
+//=======================================================================================================================
+// Coloca uma palavra na fila de gravação e retorna sem aguardar a gravação. Só aguarda se a fila estiver cheia.
+//=======================================================================================================================
 void eepromWriteWord(uint16_t index, uint16_t data)
 {
-    uint16_t offset;
-    
-    NVMCON = 0x4004;                         // Configura NVMCON para escrever uma palavra
-    TBLPAG = __builtin_tblpage(&eeData);     // Inicializa TBLPAG com o endeereo superior
-    offset = __builtin_tbloffset(&eeData);   // Obtm o endereo inferior base
-    offset += index * sizeof(uint16_t);      // Ajusta o offset para o endereo desejado
-    __builtin_tblwtl(offset, data);          // Escreve dado no latch de escrita
-    asm volatile ("disi #5");                // Desabilita interrupes por 5 instrues
-    __builtin_write_NVM();                   // Desbloqueia EEPROM para alteraes e executa o comando
-    while(_WR);                              // Aguarda a escrita do dado
+    uint8_t position;
+
+    // Uma palavra que já está na fila, e cuja gravação ainda não começou, só tem o valor atualizado
+    TurnNVMInterruptOff();
+    for(uint8_t queued = 1; queued < queueCount; queued++)
+    {
+        position = (queueHead + queued) % EEPROM_QUEUE_SIZE;
+        if(writeQueue[position].index == index)
+        {
+            writeQueue[position].data = data;
+            TurnNVMInterruptOn();
+            return;
+        }
+    }
+    TurnNVMInterruptOn();
+
+    while(queueCount == EEPROM_QUEUE_SIZE);  // Fila cheia: aguarda a interrupção liberar uma posição
+
+    TurnNVMInterruptOff();
+    position = (queueHead + queueCount) % EEPROM_QUEUE_SIZE;
+    writeQueue[position].index = index;
+    writeQueue[position].data = data;
+    queueCount++;
+    if(queueCount == 1)
+        startQueuedWrite();
+    TurnNVMInterruptOn();
 }
 
+//=======================================================================================================================
+// Lê uma palavra. Palavras ainda na fila são lidas da fila, com o valor mais recente.
+//=======================================================================================================================
 uint16_t eepromReadWord(uint16_t index)
 {
-    uint16_t offset;
+    uint16_t offset, data;
+    uint8_t position;
 
-    TBLPAG = __builtin_tblpage(&eeData);     // Inicializa TBLPAG com o endeereo superior
-    offset = __builtin_tbloffset(&eeData);   // Obtm o endereo inferior base
-    offset += index * sizeof(uint16_t);      // Ajusta o offset para o endereo desejado
-    return __builtin_tblrdl(offset);         // L o dado no endereo desejado
+    TurnNVMInterruptOff();
+    for(uint8_t queued = queueCount; queued > 0; queued--)
+    {
+        position = (queueHead + queued - 1) % EEPROM_QUEUE_SIZE;
+        if(writeQueue[position].index == index)
+        {
+            data = writeQueue[position].data;
+            TurnNVMInterruptOn();
+            return data;
+        }
+    }
+
+    while(_WR);                              // A EEPROM não é lida durante uma gravação
+    TBLPAG = __builtin_tblpage(&eeData);     // Inicializa TBLPAG com o endeereço superior
+    offset = __builtin_tbloffset(&eeData);   // Obtém o endereço inferior base
+    offset += index * sizeof(uint16_t);      // Ajusta o offset para o endereço desejado
+    data = __builtin_tblrdl(offset);         // Lê o dado no endereço desejado
+    TurnNVMInterruptOn();
+    return data;
 }
 
 void eepromEraseWord(uint16_t index)
 {
     uint16_t offset;
     
+    eepromFlush();
     NVMCON = 0x4058;                         // Configura NVMCON para apagar uma palavra
-    TBLPAG = __builtin_tblpage(&eeData);     // Inicializa TBLPAG com o endeereo superior
-    offset = __builtin_tbloffset(&eeData);   // Obtm o endereo inferior base
-    offset += index * sizeof(uint16_t);      // Ajusta o offset para o endereo desejado
+    TBLPAG = __builtin_tblpage(&eeData);     // Inicializa TBLPAG com o endeereço superior
+    offset = __builtin_tbloffset(&eeData);   // Obtém o endereço inferior base
+    offset += index * sizeof(uint16_t);      // Ajusta o offset para o endereço desejado
     __builtin_tblwtl(offset, 0);             // Escreve 0 no latch de escrita para apagar
-    asm volatile ("disi #5");                // Desabilita interrupes por 5 instrues
-    __builtin_write_NVM();                   // Desbloqueia EEPROM para alteraes e executa o comando
+    asm volatile ("disi #5");                // Desabilita interrupções por 5 instruções
+    __builtin_write_NVM();                   // Desbloqueia EEPROM para alterações e executa o comando
     while(_WR);                              // Aguarda o apagamento do dado
 }
 
@@ -73,11 +181,11 @@ uint8_t saveToEEPROM(uint8_t *data, uint16_t address, uint16_t size)
     uint16_t wordToSave, addressToSave;
     uint8_t wordIndex;
     
-    if(address > 256 || size > 256)
+    if(address > EEPROM_SIZE || size > 256)
         return 0;
     
-    if(address + size > 256)
-        size = 256 - address;
+    if(address + size > EEPROM_SIZE)
+        size = EEPROM_SIZE - address;
     
     wordToSave = eepromReadWord(address >> 1);
     for(uint16_t index = 0; index < size; index++)
@@ -87,7 +195,9 @@ uint8_t saveToEEPROM(uint8_t *data, uint16_t address, uint16_t size)
         addressToSave = (address + index) >> 1;
         if(wordIndex)
         {
-            eepromWriteWord(addressToSave, wordToSave);
+            // Palavras que não mudaram não são regravadas, poupando tempo e ciclos de escrita.
+            if(eepromReadWord(addressToSave) != wordToSave)
+                eepromWriteWord(addressToSave, wordToSave);
             wordToSave = eepromReadWord((address + index + 1) >> 1);
         }
     }
@@ -100,11 +210,11 @@ uint8_t loadFromEEPROM(uint8_t *data, uint16_t address, uint16_t size)
     int16_t wordReaded, addressToRead;
     uint8_t wordIndex;
     
-    if(address > 256 || size > 256)
+    if(address > EEPROM_SIZE || size > 256)
         return 0;
     
-    if(address + size > 256)
-        size = 256 - address;
+    if(address + size > EEPROM_SIZE)
+        size = EEPROM_SIZE - address;
     
     for(uint16_t index = 0; index < size; index++)
     {
@@ -118,17 +228,25 @@ uint8_t loadFromEEPROM(uint8_t *data, uint16_t address, uint16_t size)
 }
 
 //***********************************************************************************************************************
-// Funes pblicas
+// Funções públicas
 //***********************************************************************************************************************
 //-----------------------------------------------------------------------------------------------------------------------
-// Salva configuraes do sistema
+// Salva configurações do sistema
 //-----------------------------------------------------------------------------------------------------------------------
 void initEEPROM(uint8_t *defaultConfigData, uint16_t defaultConfigSize)
 {
-    if(eepromReadWord(0) != CONFIG_SAVED_ID)
+    // O tamanho da configuração compõe o identificador. Assim, uma mudança no layout da configuração restaura os
+    // valores padrão, em vez de carregar campos novos a partir de dados antigos.
+    uint16_t configID = CONFIG_SAVED_ID + defaultConfigSize;
+
+    _NVMIF = 0;
+    _NVMIP = 3;                     // Prioridade 3 para o fim das gravações
+    TurnNVMInterruptOn();
+
+    if(eepromReadWord(0) != configID)
     {
         saveToEEPROM(defaultConfigData, 2, defaultConfigSize);        
-        eepromWriteWord(0, CONFIG_SAVED_ID);
+        eepromWriteWord(0, configID);
     }
 }
 
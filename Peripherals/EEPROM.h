@@ -5,8 +5,9 @@
 #define	PERIPHERALS_EEPROM
 
 //=======================================================================================================================
-// Funes do mdulo
+// Funções do módulo
 //=======================================================================================================================
+extern void eepromFlush(void);
 extern void eepromBulkErase(void);
 extern void eepromWriteWord(uint16_t index, uint16_t data);
 extern uint16_t eepromReadWord(uint16_t index);
@@ -0,0 +1,54 @@
+//***********************************************************************************************************************
+//                                         Módulo de Memória de Programa (Flash)
+//***********************************************************************************************************************
+#include "Flash.h"
+#include "EEPROM.h"
+#include <xc.h>
+
+//***********************************************************************************************************************
+// Funções públicas
+//***********************************************************************************************************************
+//=======================================================================================================================
+// Apaga uma linha da memória de programa. O offset deve estar alinhado ao início da linha. O controlador da NVM é o
+// mesmo da EEPROM, então as gravações pendentes na EEPROM são concluídas antes.
+//=======================================================================================================================
+void flashEraseRow(uint16_t page, uint16_t offset)
+{
+    eepromFlush();
+    NVMCON = 0x4058;                         // Configura NVMCON para apagar uma linha
+    TBLPAG = page;                           // Endereço superior da linha
+    __builtin_tblwtl(offset, 0);             // Escrita fictícia para definir o endereço da linha
+    asm volatile ("disi #5");                // Desabilita interrupções por 5 instruções
+    __builtin_write_NVM();                   // Desbloqueia a memória para alterações e executa o comando
+    while(_WR);                              // Aguarda o apagamento
+}
+
+//=======================================================================================================================
+// Escreve uma linha inteira (FLASH_ROW_WORDS palavras) da memória de programa. A linha deve estar apagada.
+//=======================================================================================================================
+void flashWriteRow(uint16_t page, uint16_t offset, uint16_t *data)
+{
+    eepromFlush();
+    NVMCON = 0x4004;                         // Configura NVMCON para escrever uma linha
+    TBLPAG = page;
+    for(uint8_t index = 0; index < FLASH_ROW_WORDS; index++)
+    {
+        __builtin_tblwtl(offset, data[index]);  // Escreve os 16 bits inferiores no latch de escrita
+        __builtin_tblwth(offset, 0xFF);         // O byte superior fica no estado apagado
+        offset += 2;
+    }
+    asm volatile ("disi #5");                // Desabilita interrupções por 5 instruções
+    __builtin_write_NVM();                   // Desbloqueia a memória para alterações e executa o comando
+    while(_WR);                              // Aguarda a escrita da linha
+}
+
+//=======================================================================================================================
+// Lê os 16 bits inferiores de uma instrução da memória de programa
+//=======================================================================================================================
+uint16_t flashReadWord(uint16_t page, uint16_t offset)
+{
+    TBLPAG = page;
+    return __builtin_tblrdl(offset);
+}
+
+//***********************************************************************************************************************
\ No newline at end of file
@@ -0,0 +1,22 @@
+//***********************************************************************************************************************
+//                              Estante Irrigada - Memória de Programa (Flash)
+//***********************************************************************************************************************
+#ifndef PERIPHERALS_FLASH
+#define	PERIPHERALS_FLASH
+
+#include <xc.h>
+
+//=======================================================================================================================
+// Definições
+//=======================================================================================================================
+#define FLASH_ROW_WORDS         32          // Instruções por linha. A linha é a menor unidade de apagamento e escrita.
+
+//=======================================================================================================================
+// Funções do módulo. Os endereços são de memória de programa (TBLPAG e offset). Apenas os 16 bits inferiores de cada
+// instrução são usados para dados.
+//=======================================================================================================================
+extern void flashEraseRow(uint16_t page, uint16_t offset);
+extern void flashWriteRow(uint16_t page, uint16_t offset, uint16_t *data);
+extern uint16_t flashReadWord(uint16_t page, uint16_t offset);
+#endif
+//***********************************************************************************************************************
\ No newline at end of file
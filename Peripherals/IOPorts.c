@@ -2,17 +2,17 @@
 //                                                IO PORTS
 //
 // Data:         16/08/2024
-// Descrio:    Definies utilizadas para modularizao de Portas de IO
-// Dependncias: Nenhuma
+// Descrição:    Definições utilizadas para modularização de Portas de IO
+// Dependências: Nenhuma
 //***********************************************************************************************************************
 #include <xc.h>
 #include "IOPorts.h"
 
 //***********************************************************************************************************************
-// Funes privadas
+// Funções privadas
 //***********************************************************************************************************************
 //=======================================================================================================================
-// Define a direo de uma porta de IO
+// Define a direção de uma porta de IO
 //=======================================================================================================================
 static void setPortDirection(uint8_t ioPort, uint16_t direction)
 {
@@ -23,7 +23,7 @@ static void setPortDirection(uint8_t ioPort, uint16_t direction)
 }
 
 //=======================================================================================================================
-// Obtm a direo de uma porta de IO
+// Obtém a direção de uma porta de IO
 //=======================================================================================================================
 static uint16_t getPortDirection(uint8_t ioPort)
 {
@@ -47,7 +47,7 @@ static void setPortOpenDrainState(uint8_t ioPort, uint16_t openDrainState)
 }
 
 //=======================================================================================================================
-// Obtm o estado Open Drain de uma porta
+// Obtém o estado Open Drain de uma porta
 //=======================================================================================================================
 static uint16_t getPortOpenDrainState(uint8_t ioPort)
 {
@@ -71,7 +71,21 @@ static void setPort(uint8_t ioPort, uint16_t value)
 }
 
 //=======================================================================================================================
-// L o valor de uma porta
+// Obtém o valor escrito em uma porta. Diferente de PORTx, não depende do nível lido no pino, o que evita que um pino
+// ainda em transição seja regravado com o valor errado numa leitura-modificação-escrita.
+//=======================================================================================================================
+static uint16_t getPortLatch(uint8_t ioPort)
+{
+    if(ioPort == IO_PORTA)
+        return LATA;
+    else if(ioPort == IO_PORTB)
+        return LATB;
+    else
+        return 0x0000;
+}
+
+//=======================================================================================================================
+// Lê o valor de uma porta
 //=======================================================================================================================
 static uint16_t getPort(uint8_t ioPort)
 {
@@ -84,10 +98,10 @@ static uint16_t getPort(uint8_t ioPort)
 }
 
 //***********************************************************************************************************************
-// Funes pblicas
+// Funções públicas
 //***********************************************************************************************************************
 //=======================================================================================================================
-// Define a direo de um pino de IO
+// Define a direção de um pino de IO
 //=======================================================================================================================
 void setPinDirection(IOPort_t ioPin, uint8_t direction)
 {
@@ -102,7 +116,7 @@ void setPinDirection(IOPort_t ioPin, uint8_t direction)
 }
 
 //=======================================================================================================================
-// Obtm direo de um pino de IO
+// Obtém direção de um pino de IO
 //=======================================================================================================================
 uint16_t getPinDirection(IOPort_t ioPin)
 {
@@ -113,7 +127,7 @@ uint16_t getPinDirection(IOPort_t ioPin)
 }
 
 //=======================================================================================================================
-// Define se um pino  coletor aberto
+// Define se um pino é coletor aberto
 //=======================================================================================================================
 void setPinOpenDrainState(IOPort_t ioPin, uint8_t openDrainState)
 {
@@ -160,7 +174,7 @@ void invertPin(IOPort_t ioPin)
 }
 
 //=======================================================================================================================
-// L o valor de um pino
+// Lê o valor de um pino
 //=======================================================================================================================
 uint16_t readPin(IOPort_t ioPin)
 {
@@ -176,15 +190,75 @@ uint16_t readPin(IOPort_t ioPin)
 }
 
 //=======================================================================================================================
-// Atravs de uma lista de configuraes de pinos, atribui todas as configuraes aos pinos selecionados
+// Através de uma lista de configurações de pinos, atribui todas as configurações aos pinos selecionados. A lista é
+// convertida em máscaras por porta, e cada registrador é escrito uma única vez. O valor inicial é escrito antes da
+// direção, para que as saídas já surjam no estado correto.
 //=======================================================================================================================
 void setupPinList(const IOPortSetup_t *list, uint8_t size)
 {
+    uint16_t usedPins[IO_PORTS] = {0}, inputs[IO_PORTS] = {0}, openDrain[IO_PORTS] = {0}, states[IO_PORTS] = {0};
+    uint16_t pinMask;
+    uint8_t port;
+
     for(uint8_t index=0; index < size; index++)
     {
-        setPinDirection(list[index].ioPin, list[index].direction);
-        setPinOpenDrainState(list[index].ioPin, list[index].openDrain);
-        writePin(list[index].ioPin, list[index].initialState);
+        port = list[index].ioPin.Port;
+        if(port >= IO_PORTS)
+            continue;
+
+        pinMask = (list[index].ioPin.Pin == ALL_PINS) ? 0xFFFF : (1 << list[index].ioPin.Pin);
+        usedPins[port] |= pinMask;
+        inputs[port] = (list[index].direction == IO_INPUT) ? (inputs[port] | pinMask) : (inputs[port] & ~pinMask);
+        openDrain[port] = (list[index].openDrain == IO_OPEN_DRAIN) ? (openDrain[port] | pinMask) : (openDrain[port] & ~pinMask);
+        states[port] = list[index].initialState ? (states[port] | pinMask) : (states[port] & ~pinMask);
+    }
+
+    for(port = 0; port < IO_PORTS; port++)
+    {
+        if(usedPins[port] == 0)
+            continue;
+
+        writePortMasked(port, usedPins[port], states[port]);
+        setPortOpenDrainState(port, (getPortOpenDrainState(port) & ~usedPins[port]) | openDrain[port]);
+        setPortDirection(port, (getPortDirection(port) & ~usedPins[port]) | inputs[port]);
+    }
+}
+
+//=======================================================================================================================
+// Escreve, em uma única operação, os pinos de uma porta selecionados pela máscara
+//=======================================================================================================================
+void writePortMasked(uint8_t ioPort, uint16_t mask, uint16_t value)
+{
+    setPort(ioPort, (getPortLatch(ioPort) & ~mask) | (value & mask));
+}
+
+//=======================================================================================================================
+// Acrescenta um pino, com o estado desejado, a um conjunto de pinos a ser escrito com writePortMask()
+//=======================================================================================================================
+void setPinInMask(IOPortMask_t *portMask, IOPort_t ioPin, uint8_t state)
+{
+    uint16_t pinMask;
+
+    if(ioPin.ID == IO_UNDEFINED || ioPin.Port >= IO_PORTS)
+        return;
+
+    pinMask = (ioPin.Pin == ALL_PINS) ? 0xFFFF : (1 << ioPin.Pin);
+    portMask->mask[ioPin.Port] |= pinMask;
+    if(state)
+        portMask->value[ioPin.Port] |= pinMask;
+    else
+        portMask->value[ioPin.Port] &= ~pinMask;
+}
+
+//=======================================================================================================================
+// Escreve um conjunto de pinos, com uma escrita por porta
+//=======================================================================================================================
+void writePortMask(IOPortMask_t *portMask)
+{
+    for(uint8_t port = 0; port < IO_PORTS; port++)
+    {
+        if(portMask->mask[port] != 0)
+            writePortMasked(port, portMask->mask[port], portMask->value[port]);
     }
 }
 
@@ -2,8 +2,8 @@
 //                                                IO PORTS
 //
 // Data:         16/08/2024
-// Descrio:    Definies utilizadas para modularizao de Portas de IO
-// Dependncias: Nenhuma
+// Descrição:    Definições utilizadas para modularização de Portas de IO
+// Dependências: Nenhuma
 //***********************************************************************************************************************
 #ifndef _IO_PORTS_
 #define	_IO_PORTS_
@@ -18,6 +18,7 @@
 //=======================================================================================================================
 #define IO_PORTA                0x00
 #define IO_PORTB                0x01
+#define IO_PORTS                2
 
 //=======================================================================================================================
 // ID dos Pinos
@@ -63,7 +64,7 @@
 #define IO_UNDEFINED            0xFFFF
 
 //***********************************************************************************************************************
-// Outras definies
+// Outras definições
 //***********************************************************************************************************************
 #define IO_INPUT                1
 #define IO_OUTPUT               0
@@ -75,7 +76,7 @@
 #define PIN_ON                  1
 
 //***********************************************************************************************************************
-// Tipos de variveis relacionadas ao mdulo de pinos de IO
+// Tipos de variáveis relacionadas ao módulo de pinos de IO
 //***********************************************************************************************************************
 // Define um pino de IO
 typedef union
@@ -88,7 +89,7 @@ typedef union
     };
 } IOPort_t;
 
-// Define a configurao de um pino de IO
+// Define a configuração de um pino de IO
 typedef struct
 {
     IOPort_t    ioPin;
@@ -97,8 +98,15 @@ typedef struct
     uint8_t     initialState;
 } IOPortSetup_t;
 
+// Conjunto de pinos a serem escritos de uma só vez, uma escrita por porta
+typedef struct
+{
+    uint16_t    mask[IO_PORTS];
+    uint16_t    value[IO_PORTS];
+} IOPortMask_t;
+
 //***********************************************************************************************************************
-// Funes pblicas do mdulo
+// Funções públicas do módulo
 //***********************************************************************************************************************
 extern void setPinDirection(IOPort_t ioPin, uint8_t direction);
 extern uint16_t getPinDirection(IOPort_t ioPin);
@@ -107,6 +115,9 @@ extern void writePin(IOPort_t ioPin, uint8_t state);
 extern void invertPin(IOPort_t ioPin);
 extern uint16_t readPin(IOPort_t ioPin);
 extern void setupPinList(const IOPortSetup_t *list, uint8_t size);
+extern void writePortMasked(uint8_t ioPort, uint16_t mask, uint16_t value);
+extern void setPinInMask(IOPortMask_t *portMask, IOPort_t ioPin, uint8_t state);
+extern void writePortMask(IOPortMask_t *portMask);
 
 #endif /* I_IO_PORTS_ */
 //***********************************************************************************************************************
\ No newline at end of file
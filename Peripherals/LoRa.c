@@ -1,17 +1,18 @@
 //***********************************************************************************************************************
-//                                         Mdulo LoRa
+//                                         Módulo LoRa
 //***********************************************************************************************************************
 #include "../Configuration/HardwareConfiguration.h"
 #include "SPI.h"
+#include "timers.h"
 #include "LoRa.h"
 #include <xc.h>
 #include <libpic30.h>
 
 //***********************************************************************************************************************
-// Definies internas
+// Definições internas
 //***********************************************************************************************************************
 //=======================================================================================================================
-// Registradores do mdulo LoRa
+// Registradores do módulo LoRa
 #define REG_FIFO                 0x00
 #define REG_OP_MODE              0x01
 #define REG_FRF_MSB              0x06
@@ -30,6 +31,7 @@
 #define REG_PKT_RSSI_VALUE       0x1A
 #define REG_MODEM_CONFIG_1       0x1D
 #define REG_MODEM_CONFIG_2       0x1E
+#define REG_SYMB_TIMEOUT_LSB     0x1F
 #define REG_PREAMBLE_MSB         0x20
 #define REG_PREAMBLE_LSB         0x21
 #define REG_PAYLOAD_LENGTH       0x22
@@ -47,7 +49,7 @@
 #define REG_VERSION              0x42
 #define REG_PA_DAC               0x4D
 
-// Modos de operao
+// Modos de operação
 #define MODE_LONG_RANGE_MODE     0x80
 #define MODE_SLEEP               0x00
 #define MODE_STDBY               0x01
@@ -55,10 +57,11 @@
 #define MODE_RX_CONTINUOUS       0x05
 #define MODE_RX_SINGLE           0x06
 
-// Mscaras de interrupo
+// Máscaras de interrupção
 #define IRQ_TX_DONE_MASK           0x08
 #define IRQ_PAYLOAD_CRC_ERROR_MASK 0x20
 #define IRQ_RX_DONE_MASK           0x40
+#define IRQ_RX_TIMEOUT_MASK        0x80
 
 // PA config
 #define PA_BOOST                 0x80
@@ -67,16 +70,53 @@
 
 #define MAX_PKT_LENGTH           255
 
+// Bits de configuração do modem
+#define MODEM_CONFIG_1_IMPLICIT  0x01
+#define MODEM_CONFIG_2_CRC_ON    0x04
+#define MODEM_CONFIG_3_LDRO      0x08
+
+// O RSSI do pacote é relativo a este valor na porta de baixa frequência (banda de 433MHz)
+#define RSSI_OFFSET_LF           -164
+
+// Registrador de frequência calculado em tempo de compilação: FRF = f * 2^19 / 32MHz
+#define FRF(frequency)           ((uint32_t)(((uint64_t)(frequency) << 19) / 32000000))
+#define FRF_BYTES(frequency)     {(uint8_t)(FRF(frequency) >> 16), (uint8_t)(FRF(frequency) >> 8), (uint8_t)FRF(frequency)}
+
+// Acima de 16ms por símbolo o datasheet exige a otimização para baixas taxas de dados (LowDataRateOptimize)
+#define LDRO_SYMBOL_TIME_US      16000
+
 //***********************************************************************************************************************
-// Variveis privadas do mdulo
+// Variáveis privadas do módulo
 //***********************************************************************************************************************
 static IOPort_t ioLoRaReset = {.ID = IO_UNDEFINED}, ioLoRaNSS = {.ID = IO_UNDEFINED};
+static const uint32_t bandwidthHz[] = {7800, 10400, 15600, 20800, 31250, 41700, 62500, 125000, 250000, 500000};
+static LoRaModemConfig_t modemConfig = {.spreadingFactor = 7, .bandwidth = LORA_BW_125K, .codingRate = 5, .txPower = 17, .preambleLength = 8, .channel = 0};
+
+// Plano de frequências na faixa ISM de 433,05MHz a 434,79MHz, com espaçamento de 200kHz
+static const uint8_t channelPlan[LORA_CHANNELS][3] =
+{
+    FRF_BYTES(433175000),
+    FRF_BYTES(433375000),
+    FRF_BYTES(433575000),
+    FRF_BYTES(433775000),
+    FRF_BYTES(433975000),
+    FRF_BYTES(434175000),
+    FRF_BYTES(434375000),
+    FRF_BYTES(434575000)
+};
+static uint32_t symbolTimeUs = 1024;
+static uint8_t lowDataRateOptimize = 0;
+static int8_t lastPacketSnr = 0;
+static int16_t lastPacketRssi = 0;
+static uint16_t airtimeCreditMs = AIRTIME_BUDGET_MS;
+static uint8_t receiveWindowState = LORA_RX_LISTENING;
+static uint32_t txDoneTick = 0;
 
 //***********************************************************************************************************************
-// Funes privadas
+// Funções privadas
 //***********************************************************************************************************************
 //=======================================================================================================================
-// Faz a leitura/escrita de um registrador LoRa atravs da SPI
+// Faz a leitura/escrita de um registrador LoRa através da SPI
 //=======================================================================================================================
 static uint8_t LoRaTransfer(uint8_t address, uint8_t value)
 {
@@ -99,7 +139,7 @@ static void writeLoRaRegister(uint8_t address, uint8_t data)
 }
 
 //=======================================================================================================================
-// L um registrador
+// Lê um registrador
 //=======================================================================================================================
 static uint8_t readLoRaRegister(uint8_t address)
 {
@@ -107,26 +147,24 @@ static uint8_t readLoRaRegister(uint8_t address)
 }
 
 //=======================================================================================================================
-// Define a frequncia de operao
+// Define a frequência de operação a partir de um canal do plano de frequências
 //=======================================================================================================================
-static void setLoRaFrequency(long frequency)
+static void setLoRaChannel(uint8_t channel)
 {
-    uint64_t frf = ((uint64_t)frequency << 19) / 32000000;
-    
-    writeLoRaRegister(REG_FRF_MSB, (uint8_t)(frf >> 16));
-    writeLoRaRegister(REG_FRF_MID, (uint8_t)(frf >> 8));
-    writeLoRaRegister(REG_FRF_LSB, (uint8_t)(frf >> 0));
+    writeLoRaRegister(REG_FRF_MSB, channelPlan[channel][0]);
+    writeLoRaRegister(REG_FRF_MID, channelPlan[channel][1]);
+    writeLoRaRegister(REG_FRF_LSB, channelPlan[channel][2]);
 }
 
 //=======================================================================================================================
-// Define o modo de operao do mdulo LoRa
+// Define o modo de operação do módulo LoRa
 //=======================================================================================================================
 static void setLoRaOpMode(uint8_t mode)
 {
   writeLoRaRegister(REG_OP_MODE, MODE_LONG_RANGE_MODE | mode);
 }
 //=======================================================================================================================
-// L um registrador
+// Lê um registrador
 //=======================================================================================================================
 static void setOCP(uint8_t mA)
 {
@@ -145,7 +183,7 @@ static void setOCP(uint8_t mA)
 }
 
 //=======================================================================================================================
-// Define a potncia dos amplificadores de transmisso
+// Define a potência dos amplificadores de transmissão
 //=======================================================================================================================
 static void setLoRaTxPower(int8_t level, uint8_t outputPin)
 {
@@ -165,7 +203,7 @@ static void setLoRaTxPower(int8_t level, uint8_t outputPin)
             if (level > 20)
                 level = 20;
 
-            // Diminui 3 do nvel para que a diferena 18 - 20 seja mapeada para 15 - 17
+            // Diminui 3 do nível para que a diferença 18 - 20 seja mapeada para 15 - 17
             level -= 3;
 
             // High Power +20 dBm Operation (Semtech SX1276/77/78/79 5.4.3.)
@@ -177,7 +215,7 @@ static void setLoRaTxPower(int8_t level, uint8_t outputPin)
             if (level < 2) 
                 level = 2;
 
-            // Valor padro PA_HF/LF or +17dBm
+            // Valor padrão PA_HF/LF or +17dBm
             writeLoRaRegister(REG_PA_DAC, 0x84);
             setOCP(100);
         }
@@ -187,7 +225,7 @@ static void setLoRaTxPower(int8_t level, uint8_t outputPin)
 }
 
 //=======================================================================================================================
-// Define o modo de transmisso de pacotes do mdulo LoRa
+// Define o modo de transmissão de pacotes do módulo LoRa
 //=======================================================================================================================
 static void setLoRaPacketMode(uint8_t mode)
 {
@@ -197,11 +235,86 @@ static void setLoRaPacketMode(uint8_t mode)
         writeLoRaRegister(REG_MODEM_CONFIG_1, readLoRaRegister(REG_MODEM_CONFIG_1) | 0x01);
 }
 
+//=======================================================================================================================
+// Define o spreading factor. A otimização de detecção depende do SF, mas como o SF6 não é suportado, usa-se sempre
+// os valores de SF7 a SF12.
+//=======================================================================================================================
+static void setLoRaSpreadingFactor(uint8_t spreadingFactor)
+{
+    writeLoRaRegister(REG_DETECTION_OPTIMIZE, 0xC3);
+    writeLoRaRegister(REG_DETECTION_THRESHOLD, 0x0A);
+    writeLoRaRegister(REG_MODEM_CONFIG_2, (readLoRaRegister(REG_MODEM_CONFIG_2) & 0x0F) | (spreadingFactor << 4));
+}
+
+//=======================================================================================================================
+// Define a largura de banda do sinal
+//=======================================================================================================================
+static void setLoRaSignalBandwidth(uint8_t bandwidth)
+{
+    writeLoRaRegister(REG_MODEM_CONFIG_1, (readLoRaRegister(REG_MODEM_CONFIG_1) & 0x0F) | (bandwidth << 4));
+}
+
+//=======================================================================================================================
+// Define a taxa de codificação, recebendo o denominador (5 a 8)
+//=======================================================================================================================
+static void setLoRaCodingRate(uint8_t denominator)
+{
+    writeLoRaRegister(REG_MODEM_CONFIG_1, (readLoRaRegister(REG_MODEM_CONFIG_1) & 0xF1) | ((denominator - 4) << 1));
+}
+
+//=======================================================================================================================
+// Define o tamanho do preâmbulo em símbolos
+//=======================================================================================================================
+static void setLoRaPreambleLength(uint16_t length)
+{
+    writeLoRaRegister(REG_PREAMBLE_MSB, (uint8_t)(length >> 8));
+    writeLoRaRegister(REG_PREAMBLE_LSB, (uint8_t)(length >> 0));
+}
+
+//=======================================================================================================================
+// Liga ou desliga a otimização para baixas taxas de dados, conforme o tempo de símbolo atual
+//=======================================================================================================================
+static void setLoRaLowDataRateOptimize(void)
+{
+    uint8_t config3 = readLoRaRegister(REG_MODEM_CONFIG_3);
+
+    lowDataRateOptimize = (symbolTimeUs > LDRO_SYMBOL_TIME_US);
+    if(lowDataRateOptimize)
+        config3 |= MODEM_CONFIG_3_LDRO;
+    else
+        config3 &= ~MODEM_CONFIG_3_LDRO;
+
+    writeLoRaRegister(REG_MODEM_CONFIG_3, config3);
+}
+
+//=======================================================================================================================
+// Abre a janela de recepção: recepção única, que termina em RX_WINDOW_SYMBOLS símbolos se nenhum preâmbulo for
+// detectado. Os 2 bits mais significativos do tempo ficam em REG_MODEM_CONFIG_2.
+//=======================================================================================================================
+static void openLoRaReceiveWindow(void)
+{
+    writeLoRaRegister(REG_MODEM_CONFIG_2, (readLoRaRegister(REG_MODEM_CONFIG_2) & 0xFC) | ((RX_WINDOW_SYMBOLS >> 8) & 0x03));
+    writeLoRaRegister(REG_SYMB_TIMEOUT_LSB, (uint8_t)RX_WINDOW_SYMBOLS);
+    writeLoRaRegister(REG_FIFO_ADDR_PTR, 0);
+    setLoRaPacketMode(EXPLICIT_MODE);
+    setLoRaOpMode(MODE_RX_SINGLE);
+}
+
+//=======================================================================================================================
+// Desconta do crédito de ocupação do canal o tempo no ar de um pacote
+//=======================================================================================================================
+static void chargeLoRaAirtime(uint32_t timeOnAirUs)
+{
+    uint32_t timeOnAirMs = timeOnAirUs / 1000;
+
+    airtimeCreditMs = (timeOnAirMs >= airtimeCreditMs) ? 0 : (airtimeCreditMs - (uint16_t)timeOnAirMs);
+}
+
 //***********************************************************************************************************************
-// Funes pblicas
+// Funções públicas
 //***********************************************************************************************************************
 //=======================================================================================================================
-// Inicializa mdulo LoRa
+// Inicializa módulo LoRa
 //=======================================================================================================================
 uint8_t initLoRa(uint16_t resetPinID, uint16_t NSSPinID)
 {
@@ -213,68 +326,74 @@ uint8_t initLoRa(uint16_t resetPinID, uint16_t NSSPinID)
     if(ioLoRaReset.ID == IO_UNDEFINED || ioLoRaNSS.ID == IO_UNDEFINED)
         return 0;
     
-    writePin(ioLoRaReset, PIN_OFF);  // Reseta o mdulo LoRa
+    writePin(ioLoRaReset, PIN_OFF);  // Reseta o módulo LoRa
     __delay_ms(10);
-    writePin(ioLoRaReset, PIN_ON);  // Liga o mdulo LoRa
-    __delay_ms(10);                 // Tempo necessrio para o mdulo entrar em funcionamento.
+    writePin(ioLoRaReset, PIN_ON);  // Liga o módulo LoRa
+    __delay_ms(10);                 // Tempo necessário para o módulo entrar em funcionamento.
     
     version = readLoRaRegister(REG_VERSION);
     if(version != 0x12)
         return 0;
 
-    // O modo LoRa s pode ser setado quando o chip est em modo Sleep.
-    // O modo Sleep tambm limpa todo o contedo dos buffers
+    // O modo LoRa só pode ser setado quando o chip está em modo Sleep.
+    // O modo Sleep também limpa todo o conteúdo dos buffers
     setLoRaOpMode(MODE_SLEEP);
     
-    setLoRaFrequency(433E6);
-    // Define os endereos base para os buffers
+    // Define os endereços base para os buffers
     writeLoRaRegister(REG_FIFO_TX_BASE_ADDR, 0);
     writeLoRaRegister(REG_FIFO_RX_BASE_ADDR, 0);
 
     // Liga o LNA boost
     writeLoRaRegister(REG_LNA, readLoRaRegister(REG_LNA) | 0x03);
   
-    // Liga o controle automtico de ganho
+    // Liga o controle automático de ganho
     writeLoRaRegister(REG_MODEM_CONFIG_3, 0x04);
     
-    setLoRaTxPower(17, PA_OUTPUT_PA_BOOST_PIN);
+    setLoRaModemConfig(&modemConfig);
     
-    // Inicia o modo padro de operao do mdulo.
+    // Inicia o modo padrão de operação do módulo.
     setLoRaOpMode(MODE_STDBY);
     
     return 1;
 }
 
 //=======================================================================================================================
-// Verifica se o mdulo LoRa est transmitindo dados
+// Verifica se o módulo LoRa está transmitindo dados
 //=======================================================================================================================
 uint8_t isLoRaTransmitting(void)
 {
-  // Verifica se ainda est em modo de transmisso 
+  // Verifica se ainda está em modo de transmissão 
   if ((readLoRaRegister(REG_OP_MODE) & MODE_TX) == MODE_TX) 
     return 1;
 
-  // Limpa o flag de interrupo, caso esteja setado.
+  // Limpa o flag de interrupção, caso esteja setado.
   if (readLoRaRegister(REG_IRQ_FLAGS) & IRQ_TX_DONE_MASK) 
     writeLoRaRegister(REG_IRQ_FLAGS, IRQ_TX_DONE_MASK);
 
+  // Fim de uma transmissão: a janela de recepção conta a partir daqui
+  if (receiveWindowState == LORA_RX_TRANSMITTING)
+  {
+    txDoneTick = getTimerInterruptCount();
+    receiveWindowState = LORA_RX_WINDOW_WAIT;
+  }
+
   return 0;
 }
 
 //=======================================================================================================================
-// Inicializa o modo de transmisso LoRa, para que pacotes sejam carregados em sua memria.
+// Inicializa o modo de transmissão LoRa, para que pacotes sejam carregados em sua memória.
 //=======================================================================================================================
 uint8_t beginLoRaPacket(uint8_t implicitHeader)
 {
     if (isLoRaTransmitting())
         return 0;
 
-    // Coloca o mdulo em modo Standby para transmisso.
+    // Coloca o módulo em modo Standby para transmissão.
     setLoRaOpMode(MODE_STDBY);
 
     setLoRaPacketMode(implicitHeader);
 
-    // Reseta os endereos de escrita e tamanho do payload
+    // Reseta os endereços de escrita e tamanho do payload
     writeLoRaRegister(REG_FIFO_ADDR_PTR, 0);
     writeLoRaRegister(REG_PAYLOAD_LENGTH, 0);
 
@@ -282,13 +401,13 @@ uint8_t beginLoRaPacket(uint8_t implicitHeader)
 }
 
 //=======================================================================================================================
-// Carrega um buffer para a memria de transmisso do mdulo LoRa
+// Carrega um buffer para a memória de transmissão do módulo LoRa
 //=======================================================================================================================
 uint8_t loadBufferToLoRa(uint8_t *buffer, uint8_t size)
 {
     uint8_t currentLength = readLoRaRegister(REG_PAYLOAD_LENGTH);
 
-    // Garante que o pacote atual no vai ser escrito alm dos limites do buffer do mdulo LoRa
+    // Garante que o pacote atual não vai ser escrito além dos limites do buffer do módulo LoRa
     if ((currentLength + size) > MAX_PKT_LENGTH)
         size = MAX_PKT_LENGTH - currentLength;
 
@@ -303,7 +422,7 @@ uint8_t loadBufferToLoRa(uint8_t *buffer, uint8_t size)
 }
 
 //=======================================================================================================================
-// Escreve um byte na memria de transmisso do mdulo LoRa
+// Escreve um byte na memória de transmissão do módulo LoRa
 //=======================================================================================================================
 uint8_t writeByteToLora(uint8_t byte)
 {
@@ -311,26 +430,35 @@ uint8_t writeByteToLora(uint8_t byte)
 }
 
 //=======================================================================================================================
-// Finaliza o carregamento de dados para o buffer de transmisso e inicia o envio
+// Finaliza o carregamento de dados para o buffer de transmissão e inicia o envio. Retorna sem esperar o fim da
+// transmissão, que é verificado por isLoRaTransmitting().
 //=======================================================================================================================
 void endLoRaPacket(void)
 {
-    // Coloca o mdulo em modo de transmisso
+    chargeLoRaAirtime(getLoRaTimeOnAir(readLoRaRegister(REG_PAYLOAD_LENGTH)));
+
+    // Coloca o módulo em modo de transmissão
     setLoRaOpMode(MODE_TX);
-    
-    while ((readLoRaRegister(REG_IRQ_FLAGS) & IRQ_TX_DONE_MASK) == 0);
-    writeLoRaRegister(REG_IRQ_FLAGS, IRQ_TX_DONE_MASK);
+
+    // Cada transmissão abre uma janela de recepção RX_WINDOW_DELAY_MS depois do seu fim
+    receiveWindowState = LORA_RX_TRANSMITTING;
 }
 
 //=======================================================================================================================
-// Verifica se houve uma recepo
+// Verifica se houve uma recepção. Até a primeira transmissão, o módulo fica em recepção contínua. Depois dela, só
+// escuta na janela aberta após cada transmissão, e sem preâmbulo na janela o rádio vai para o modo Sleep.
 //=======================================================================================================================
 uint8_t checkLoRaReception(void)
 {
-    uint8_t irqFlags = readLoRaRegister(REG_IRQ_FLAGS);
+    uint8_t irqFlags;
     uint8_t packetLength = 0;
+
+    if(isLoRaTransmitting())
+        return 0;
+
+    irqFlags = readLoRaRegister(REG_IRQ_FLAGS);
     
-    // Limpa os flags de interrupo
+    // Limpa os flags de interrupção
     writeLoRaRegister(REG_IRQ_FLAGS, irqFlags);
     
     // Pacote recebido
@@ -338,16 +466,49 @@ uint8_t checkLoRaReception(void)
     {
         packetLength = readLoRaRegister(REG_RX_NB_BYTES);
         
-        // Define o endereo de leitura para o endereo atual
+        // Qualidade do enlace. Com SNR negativo, o sinal está abaixo do ruído e o RSSI precisa ser corrigido.
+        lastPacketSnr = (int8_t)readLoRaRegister(REG_PKT_SNR_VALUE);
+        lastPacketRssi = RSSI_OFFSET_LF + readLoRaRegister(REG_PKT_RSSI_VALUE);
+        if(lastPacketSnr < 0)
+            lastPacketRssi += lastPacketSnr / 4;
+
+        // Define o endereço de leitura para o endereço atual
         writeLoRaRegister(REG_FIFO_ADDR_PTR, readLoRaRegister(REG_FIFO_RX_CURRENT_ADDR));
         
-        // Coloca o mdulo em modo Standby para transmisso.
+        // Coloca o módulo em modo Standby para transmissão.
         setLoRaOpMode(MODE_STDBY);
+
+        // O roteador pode encadear outro pacote, na mesma temporização de uma resposta
+        if(receiveWindowState != LORA_RX_LISTENING)
+        {
+            txDoneTick = getTimerInterruptCount();
+            receiveWindowState = LORA_RX_WINDOW_WAIT;
+        }
+    }
+    else if(receiveWindowState == LORA_RX_WINDOW_WAIT)
+    {
+        if((getTimerInterruptCount() - txDoneTick) >= RX_WINDOW_DELAY_MS)
+        {
+            openLoRaReceiveWindow();
+            receiveWindowState = LORA_RX_WINDOW_OPEN;
+        }
     }
-    else if(readLoRaRegister(REG_OP_MODE) != (MODE_LONG_RANGE_MODE | MODE_RX_SINGLE))  // No est em modo de recepo
+    else if(receiveWindowState == LORA_RX_WINDOW_OPEN)
     {
-        // Reseta o endereo da FIFO
+        // Sem preâmbulo na janela, ou pacote corrompido: o rádio dorme até a próxima transmissão
+        if(irqFlags & (IRQ_RX_TIMEOUT_MASK | IRQ_PAYLOAD_CRC_ERROR_MASK))
+        {
+            setLoRaOpMode(MODE_SLEEP);
+            receiveWindowState = LORA_RX_WINDOW_CLOSED;
+        }
+    }
+    else if(receiveWindowState == LORA_RX_LISTENING &&
+            readLoRaRegister(REG_OP_MODE) != (MODE_LONG_RANGE_MODE | MODE_RX_SINGLE))  // Não está em modo de recepção
+    {
+        // Reseta o endereço da FIFO
         writeLoRaRegister(REG_FIFO_ADDR_PTR, 0);
+        // A recepção é sempre com cabeçalho explícito, mesmo depois de uma transmissão com cabeçalho implícito
+        setLoRaPacketMode(EXPLICIT_MODE);
         setLoRaOpMode(MODE_RX_SINGLE);
     }
     
@@ -355,7 +516,23 @@ uint8_t checkLoRaReception(void)
 }
 
 //=======================================================================================================================
-// Retorna quantos bytes no foram lidos do buffer de recepo
+// Estado da janela de recepção: LORA_RX_xxx
+//=======================================================================================================================
+uint8_t getLoRaReceiveWindowState(void)
+{
+    return receiveWindowState;
+}
+
+//=======================================================================================================================
+// Volta para a recepção contínua, até a próxima transmissão
+//=======================================================================================================================
+void resumeLoRaListening(void)
+{
+    receiveWindowState = LORA_RX_LISTENING;
+}
+
+//=======================================================================================================================
+// Retorna quantos bytes não foram lidos do buffer de recepção
 //=======================================================================================================================
 uint8_t LoRaBytesAvailable(void)
 {
@@ -370,7 +547,7 @@ uint8_t LoRaBytesAvailable(void)
 }
 
 //=======================================================================================================================
-// L um byte do mdulo
+// Lê um byte do módulo
 //=======================================================================================================================
 uint8_t readByteFromLoRa(void)
 {
@@ -380,11 +557,125 @@ uint8_t readByteFromLoRa(void)
 }
 
 //=======================================================================================================================
-// L um byte do mdulo
+// Verifica se uma configuração de modem está dentro dos limites suportados
+//=======================================================================================================================
+uint8_t isLoRaModemConfigValid(LoRaModemConfig_t *config)
+{
+    return((config->spreadingFactor >= LORA_MIN_SF) && (config->spreadingFactor <= LORA_MAX_SF) &&
+           (config->bandwidth <= LORA_BW_500K) &&
+           (config->codingRate >= LORA_MIN_CR) && (config->codingRate <= LORA_MAX_CR) &&
+           (config->txPower >= LORA_MIN_TX_POWER) && (config->txPower <= LORA_MAX_TX_POWER) &&
+           (config->preambleLength >= LORA_MIN_PREAMBLE) &&
+           (config->channel < LORA_CHANNELS));
+}
+
+//=======================================================================================================================
+// Aplica uma configuração de modem. Os registros só podem ser alterados em modo Sleep ou Standby: uma recepção em
+// andamento é interrompida, com o rádio em Standby, e retomada pelo caminho normal. Uma janela aberta volta a ser
+// aberta por checkLoRaReception(), já com a nova configuração, e a recepção contínua é reativada por ela.
+//=======================================================================================================================
+void setLoRaModemConfig(LoRaModemConfig_t *config)
+{
+    if(!isLoRaModemConfigValid(config))
+        return;
+
+    if((readLoRaRegister(REG_OP_MODE) & 0x07) != MODE_SLEEP)
+        setLoRaOpMode(MODE_STDBY);
+    if(receiveWindowState == LORA_RX_WINDOW_OPEN)
+        receiveWindowState = LORA_RX_WINDOW_WAIT;
+
+    modemConfig = *config;
+
+    // Tempo de símbolo: Ts = 2^SF / BW. Calculado apenas aqui para que o cálculo de tempo no ar não faça divisões.
+    symbolTimeUs = ((uint32_t)1000000 << modemConfig.spreadingFactor) / bandwidthHz[modemConfig.bandwidth];
+
+    setLoRaChannel(modemConfig.channel);
+    setLoRaSpreadingFactor(modemConfig.spreadingFactor);
+    setLoRaSignalBandwidth(modemConfig.bandwidth);
+    setLoRaCodingRate(modemConfig.codingRate);
+    setLoRaPreambleLength(modemConfig.preambleLength);
+    setLoRaLowDataRateOptimize();
+    setLoRaTxPower(modemConfig.txPower, PA_OUTPUT_PA_BOOST_PIN);
+}
+
+//=======================================================================================================================
+// Calcula o tempo no ar de um pacote, em microssegundos, para a configuração atual do modem (Semtech AN1200.13):
+//   símbolos do payload = 8 + max(ceil((8PL - 4SF + 28 + 16CRC - 20IH) / (4(SF - 2DE))) * (CR + 4), 0)
+//   tempo no ar = (preâmbulo + 4,25 + símbolos do payload) * Ts
+//=======================================================================================================================
+uint32_t getLoRaTimeOnAir(uint8_t payloadLength)
+{
+    uint8_t config1 = readLoRaRegister(REG_MODEM_CONFIG_1);
+    uint8_t config2 = readLoRaRegister(REG_MODEM_CONFIG_2);
+    int16_t numerator;
+    uint16_t divisor, payloadSymbols = 8;
+
+    numerator = (8 * (int16_t)payloadLength) - (4 * modemConfig.spreadingFactor) + 28;
+    if(config2 & MODEM_CONFIG_2_CRC_ON)
+        numerator += 16;
+    if(config1 & MODEM_CONFIG_1_IMPLICIT)
+        numerator -= 20;
+
+    if(numerator > 0)
+    {
+        divisor = 4 * (modemConfig.spreadingFactor - (lowDataRateOptimize ? 2 : 0));
+        payloadSymbols += ((numerator + divisor - 1) / divisor) * modemConfig.codingRate;
+    }
+
+    // Contagem em quartos de símbolo para incluir os 4,25 símbolos de sincronismo sem ponto flutuante
+    return(((uint32_t)4 * (modemConfig.preambleLength + payloadSymbols) + 17) * (symbolTimeUs >> 2));
+}
+
+//=======================================================================================================================
+// SNR do último pacote recebido, em quartos de dB
+//=======================================================================================================================
+int8_t getLoRaPacketSnr(void)
+{
+    return lastPacketSnr;
+}
+
+//=======================================================================================================================
+// RSSI do último pacote recebido, em dBm
+//=======================================================================================================================
+int16_t getLoRaPacketRssi(void)
+{
+    return lastPacketRssi;
+}
+
+//=======================================================================================================================
+// Controle de ocupação do canal. Funciona como um balde de créditos: cada transmissão desconta seu tempo no ar, e o
+// tempo decorrido repõe AIRTIME_DUTY_PERCENT do seu valor, até o limite de uma janela (AIRTIME_BUDGET_MS). Assim, a
+// ocupação em qualquer janela de AIRTIME_WINDOW_SECONDS nunca passa do duty cycle permitido.
+//=======================================================================================================================
+void setLoRaAirtimeCredit(uint16_t creditMs)
+{
+    airtimeCreditMs = (creditMs > AIRTIME_BUDGET_MS) ? AIRTIME_BUDGET_MS : creditMs;
+}
+
+//=======================================================================================================================
+// Crédito de tempo no ar disponível, em milissegundos
+//=======================================================================================================================
+uint16_t getLoRaAirtimeCredit(void)
+{
+    return airtimeCreditMs;
+}
+
+//=======================================================================================================================
+// Repõe o crédito de tempo no ar referente a um intervalo sem transmissões
+//=======================================================================================================================
+void creditLoRaAirtime(uint16_t elapsedSeconds)
+{
+    uint32_t credit = airtimeCreditMs + ((uint32_t)elapsedSeconds * 10 * AIRTIME_DUTY_PERCENT);
+
+    airtimeCreditMs = (credit > AIRTIME_BUDGET_MS) ? AIRTIME_BUDGET_MS : (uint16_t)credit;
+}
+
+//=======================================================================================================================
+// Lê um byte do módulo
 //=======================================================================================================================
 void loraPowerDown(void)
 {
-    // Coloca o mdulo em modo Sleep para reduzir consumo.
+    // Coloca o módulo em modo Sleep para reduzir consumo.
     setLoRaOpMode(MODE_SLEEP);
 }
 
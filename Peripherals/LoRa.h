@@ -4,14 +4,64 @@
 #ifndef PERIPHERALS_LORA
 #define	PERIPHERALS_LORA
 
+#include <xc.h>
+
 //=======================================================================================================================
-// Definies
+// Definições
 //=======================================================================================================================
 #define EXPLICIT_MODE              0x00
 #define IMPLICIT_MODE              0x01
 
 //=======================================================================================================================
-// Funes pblicas do mdulo
+// Estados da janela de recepção
+//=======================================================================================================================
+#define LORA_RX_LISTENING          0      // Recepção contínua, sem janela
+#define LORA_RX_WINDOW_WAIT        1      // Aguardando o atraso da janela após uma transmissão
+#define LORA_RX_WINDOW_OPEN        2
+#define LORA_RX_WINDOW_CLOSED      3      // Nada recebido na janela. Rádio em modo Sleep.
+#define LORA_RX_TRANSMITTING       4      // Transmissão em andamento. A janela conta a partir do seu fim.
+
+//=======================================================================================================================
+// Larguras de banda, na codificação do registrador REG_MODEM_CONFIG_1
+//=======================================================================================================================
+#define LORA_BW_7K8                0x00
+#define LORA_BW_10K4               0x01
+#define LORA_BW_15K6               0x02
+#define LORA_BW_20K8               0x03
+#define LORA_BW_31K25              0x04
+#define LORA_BW_41K7               0x05
+#define LORA_BW_62K5               0x06
+#define LORA_BW_125K               0x07
+#define LORA_BW_250K               0x08
+#define LORA_BW_500K               0x09
+
+//=======================================================================================================================
+// Limites dos parâmetros do modem. SF6 exige cabeçalho implícito, por isto o mínimo aceito é SF7.
+//=======================================================================================================================
+#define LORA_MIN_SF                7
+#define LORA_MAX_SF                12
+#define LORA_MIN_CR                5      // 4/5
+#define LORA_MAX_CR                8      // 4/8
+#define LORA_MIN_PREAMBLE          6
+#define LORA_MIN_TX_POWER          2      // dBm, saída PA_BOOST
+#define LORA_MAX_TX_POWER          20
+#define LORA_CHANNELS              8      // Canais do plano de frequências, de 433,175MHz a 434,575MHz
+
+//=======================================================================================================================
+// Parâmetros de modulação do modem LoRa
+//=======================================================================================================================
+typedef struct
+{
+    uint8_t         spreadingFactor;    // 7 a 12
+    uint8_t         bandwidth;          // LORA_BW_xxx
+    uint8_t         codingRate;         // Denominador da taxa de codificação: 5 a 8 (4/5 a 4/8)
+    int8_t          txPower;            // Potência de transmissão em dBm, pela saída PA_BOOST
+    uint16_t        preambleLength;     // Em símbolos, sem contar os 4,25 símbolos fixos de sincronismo
+    uint8_t         channel;            // Índice no plano de frequências, de 0 a LORA_CHANNELS - 1
+} LoRaModemConfig_t;
+
+//=======================================================================================================================
+// Funções públicas do módulo
 //=======================================================================================================================
 extern uint8_t initLoRa(uint16_t resetPinID, uint16_t NSSPinID);
 extern uint8_t isLoRaTransmitting(void);
@@ -20,7 +70,17 @@ extern uint8_t loadBufferToLoRa(uint8_t *buffer, uint8_t size);
 extern uint8_t writeByteToLora(uint8_t byte);
 extern void    endLoRaPacket(void);
 extern uint8_t checkLoRaReception(void);
+extern uint8_t getLoRaReceiveWindowState(void);
+extern void    resumeLoRaListening(void);
 extern uint8_t LoRaBytesAvailable(void);
 extern uint8_t readByteFromLoRa(void);
+extern uint8_t isLoRaModemConfigValid(LoRaModemConfig_t *config);
+extern void    setLoRaModemConfig(LoRaModemConfig_t *config);
+extern uint32_t getLoRaTimeOnAir(uint8_t payloadLength);
+extern int8_t  getLoRaPacketSnr(void);
+extern int16_t getLoRaPacketRssi(void);
+extern void    setLoRaAirtimeCredit(uint16_t creditMs);
+extern uint16_t getLoRaAirtimeCredit(void);
+extern void    creditLoRaAirtime(uint16_t elapsedSeconds);
 
 #endif
\ No newline at end of file
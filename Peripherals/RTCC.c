@@ -1,11 +1,12 @@
 //***********************************************************************************************************************
-//                                         Mdulo de RTCC
+//                                         Módulo de RTCC
 //***********************************************************************************************************************
 #include "../Configuration/HardwareConfiguration.h"
 #include "IOPorts.h"
 #include "RTCC.h"
 #include <xc.h>
 #include <stddef.h>
+#include <string.h>
 
 //***********************************************************************************************************************
 // Macros
@@ -20,49 +21,59 @@
 #define TurnRTCCInterruptOn()       _RTCIE = 1;
 
 //***********************************************************************************************************************
-// Variveis privadas do mdulo
+// Variáveis privadas do módulo
 //***********************************************************************************************************************
 static void (*AlarmInterruptHandler)(void) = NULL;
 
+// Dias decorridos no ano antes do início de cada mês, em anos não bissextos
+static const uint16_t daysBeforeMonth[12] = {0, 31, 59, 90, 120, 151, 181, 212, 243, 273, 304, 334};
+
+// Epoch do início da hora corrente, guardado com os registros de ano, mês/dia e hora de onde foi calculado. Dentro da
+// mesma hora, readEpoch() só converte minutos e segundos. A RAM é perdida no Deep Sleep, e o cache é refeito a cada
+// despertar.
+static uint16_t hourCacheWords[3];
+static uint32_t hourCacheEpoch = 0;
+static uint8_t hourCacheValid = 0;
+
 //***********************************************************************************************************************
-// Interrupes
+// Interrupções
 //***********************************************************************************************************************
 //-----------------------------------------------------------------------------------------------------------------------
-// Interrupo do timer 1
-// Descrio: Sincronizao de tempo das vrias funes internas.
+// Interrupção do timer 1
+// Descrição: Sincronização de tempo das várias funções internas.
 //-----------------------------------------------------------------------------------------------------------------------
 void _ISR __attribute__((no_auto_psv)) _RTCCInterrupt(void)
 {
     if(AlarmInterruptHandler != NULL)
         AlarmInterruptHandler();
  
-    _RTCIF = 0;   // Limpa a flag de interrupo.
+    _RTCIF = 0;   // Limpa a flag de interrupção.
 }
 //***********************************************************************************************************************
-// Funes pblicas
+// Funções públicas
 //***********************************************************************************************************************
 //=======================================================================================================================
-// Inicializao do mdulo de RTCC
+// Inicialização do módulo de RTCC
 //=======================================================================================================================
 void initRTCC(void)
 {
-    //_RTCCMD = 0; // Habilita o mdulo de RTCC, se este foi completamente desabilitado
+    //_RTCCMD = 0; // Habilita o módulo de RTCC, se este foi completamente desabilitado
     unlockRTCC();
     
-    // Configurao do RTCC
-    RCFGCALbits.RTCOE = 0;          // Desabilita sada do RTCC
-    RCFGCALbits.CAL = 0;            // Sem ajustes ao horrio do RTC
+    // Configuração do RTCC
+    RCFGCALbits.RTCOE = 0;          // Desabilita saída do RTCC
+    RCFGCALbits.CAL = 0;            // Sem ajustes ao horário do RTC
     
-    // Configurao dos alarmes
+    // Configuração dos alarmes
     ALCFGRPT = 0;                   // Desabilita tudo antes de iniciar
     ALCFGRPTbits.AMASK = 2;         // 1 alarme a cada 10 segundos
-    ALCFGRPTbits.CHIME = 1;         // Habilita a repetio de alarmes
+    ALCFGRPTbits.CHIME = 1;         // Habilita a repetição de alarmes
     ALCFGRPTbits.ARPT = 1;
     ALCFGRPTbits.ALRMEN = 1;        // Alarm habilitado
 
     IFS3bits.RTCIF = 0;
     IEC3bits.RTCIE = 1;
-    IPC15bits.RTCIP = 4;            // Prioridade 4 para interrupes do RTCC
+    IPC15bits.RTCIP = 4;            // Prioridade 4 para interrupções do RTCC
     
     RCFGCALbits.RTCEN = 1;          // Habilita o RTCC
     
@@ -75,13 +86,14 @@ void initRTCC(void)
 void writeDateTime(DateTime_t *value)
 {
     unlockRTCC();
-    RCFGCALbits.RTCPTR = 0x03;  // Inicia a leitura apontando para o registrador de ano. O ponteiro 
+    RCFGCALbits.RTCPTR = 0x03;  // Inicia a leitura apontando para o registrador de ano. O ponteiro é
                                 // decrementado automaticamente.
     RTCVAL = value->w[0];       // Ano
-    RTCVAL = value->w[1];       // Ms e dia
+    RTCVAL = value->w[1];       // Mês e dia
     RTCVAL = value->w[2];       // Hora e dia da semana
     RTCVAL = value->w[3];       // Minuto e segundos
     lockRTCC();
+    hourCacheValid = 0;
 }
 
 //=======================================================================================================================
@@ -89,10 +101,10 @@ void writeDateTime(DateTime_t *value)
 //=======================================================================================================================
 void readDateTime(DateTime_t *value)
 {
-    RCFGCALbits.RTCPTR = 0x03;  // Inicia a leitura apontando para o registrador de ano. O ponteiro 
+    RCFGCALbits.RTCPTR = 0x03;  // Inicia a leitura apontando para o registrador de ano. O ponteiro é
                                 // decrementado automaticamente.
     value->w[0] = RTCVAL;       // Ano
-    value->w[1] = RTCVAL;       // Ms e dia
+    value->w[1] = RTCVAL;       // Mês e dia
     value->w[2] = RTCVAL;       // Hora e dia da semana
     value->w[3] = RTCVAL;       // Minuto e segundos
 }
@@ -103,29 +115,44 @@ void readDateTime(DateTime_t *value)
 void writeAlarmTime(DateTime_t *value)
 {
     unlockRTCC();
-    ALCFGRPTbits.ALRMPTR = 0x02;    // Inicia a leitura apontando para o registrador de ano. O ponteiro 
+    ALCFGRPTbits.ALRMPTR = 0x02;    // Inicia a leitura apontando para o registrador de ano. O ponteiro é
     ALCFGRPTbits.ALRMEN = 0;        // decrementado automaticamente.
-    ALRMVAL = value->w[1];          // Ms e dia
+    ALRMVAL = value->w[1];          // Mês e dia
     ALRMVAL = value->w[2];          // Hora e dia da semana
     ALRMVAL = value->w[3];          // Minuto e segundos
     ALCFGRPTbits.ALRMEN = 1;
     lockRTCC();
 }
 
+//=======================================================================================================================
+// Programa um único alarme para a hora, minuto e segundo indicados, nas próximas 24 horas. Substitui o alarme periódico
+// configurado em initRTCC(), que volta a valer na próxima inicialização.
+//=======================================================================================================================
+void writeSingleAlarm(DateTime_t *value)
+{
+    unlockRTCC();
+    ALCFGRPTbits.ALRMEN = 0;
+    ALCFGRPTbits.AMASK = 6;         // Alarme diário: compara hora, minuto e segundo
+    ALCFGRPTbits.CHIME = 0;         // Sem repetição
+    ALCFGRPTbits.ARPT = 0;
+    lockRTCC();
+    writeAlarmTime(value);
+}
+
 //=======================================================================================================================
 // Leitura de Data/Hora
 //=======================================================================================================================
 void readAlarmTime(DateTime_t *value)
 {
-    ALCFGRPTbits.ALRMPTR = 0x02;    // Inicia a leitura apontando para o registrador de ano. O ponteiro 
+    ALCFGRPTbits.ALRMPTR = 0x02;    // Inicia a leitura apontando para o registrador de ano. O ponteiro é
                                     // decrementado automaticamente.
-    value->w[1] = ALRMVAL;          // Ms e dia
+    value->w[1] = ALRMVAL;          // Mês e dia
     value->w[2] = ALRMVAL;          // Hora e dia da semana
     value->w[3] = ALRMVAL;          // Minuto e segundos
 }
 
 //=======================================================================================================================
-// Definindo a funo de tratamento de interrupo do RTC.
+// Definindo a função de tratamento de interrupção do RTC.
 //=======================================================================================================================
 void setAlarmInterruptHandler(void (*handler)(void))
 {
@@ -135,22 +162,134 @@ void setAlarmInterruptHandler(void (*handler)(void))
 }
 
 //=======================================================================================================================
-// Define se o RTC est atualizado, baseando-se no ano do desenvolvimento do projeto. Se o ano do RTC for menor que
-// o ano de desenvolvimento do projeto, define-se que este est desatualizado
+// Define se o RTC está atualizado, baseando-se no ano do desenvolvimento do projeto. Se o ano do RTC for menor que
+// o ano de desenvolvimento do projeto, define-se que este está desatualizado
 //=======================================================================================================================
 uint8_t isRTCCUpdated(void)
 {
-    DateTime_t now;
-    
-    readDateTime(&now);
-    if(bcdToInt(now.Time.year) < 24)
-        return 0;
-    else
-        return 1;
+    return(readEpoch() >= EPOCH_2024);
+}
+
+//=======================================================================================================================
+// Ajuste fino da frequência do RTCC. Cada unidade soma (ou subtrai, se negativa) 4 pulsos do relógio do RTCC por
+// minuto. É zerado em initRTCC(), então deve ser reaplicado a cada inicialização.
+//=======================================================================================================================
+void setRTCCCalibration(int8_t calibration)
+{
+    unlockRTCC();
+    RCFGCALbits.CAL = (uint8_t)calibration;
+    lockRTCC();
+}
+
+//=======================================================================================================================
+// Converte data/hora do RTCC em segundos desde 01/01/1970 (epoch Unix). O RTCC guarda apenas os dois últimos
+// dígitos do ano, que são contados a partir de 2000.
+//=======================================================================================================================
+uint32_t dateTimeToEpoch(DateTime_t *value)
+{
+    uint16_t year = bcdToInt(value->Time.year);
+    uint16_t month = bcdToInt(value->Time.month);
+    uint16_t days;
+
+    if(month < 1 || month > 12)
+        month = 1;
+
+    // Anos bissextos entre 2000 e o ano anterior. Entre 2000 e 2099 todo ano múltiplo de 4 é bissexto.
+    days = (year * 365) + ((year + 3) / 4) + daysBeforeMonth[month - 1] + bcdToInt(value->Time.day) - 1;
+    if(month > 2 && (year % 4) == 0)
+        days++;
+
+    return(EPOCH_2000 + (days * 86400UL) + (bcdToInt(value->Time.hours) * 3600UL) +
+           (bcdToInt(value->Time.minutes) * 60) + bcdToInt(value->Time.seconds));
+}
+
+//=======================================================================================================================
+// Converte segundos desde 01/01/1970 (epoch Unix) em data/hora do RTCC. Instantes anteriores a 2000 são levados
+// para 01/01/2000.
+//=======================================================================================================================
+void epochToDateTime(uint32_t epoch, DateTime_t *value)
+{
+    uint32_t seconds = (epoch > EPOCH_2000) ? (epoch - EPOCH_2000) : 0;
+    uint16_t days = seconds / 86400UL;
+    uint16_t year = 0, month = 1, yearDays, monthDays;
+
+    seconds %= 86400UL;
+    value->Time.weekday = (days + 6) % 7;       // 01/01/2000 foi um sábado
+
+    for(;;)
+    {
+        yearDays = ((year % 4) == 0) ? 366 : 365;
+        if(days < yearDays)
+            break;
+        days -= yearDays;
+        year++;
+    }
+
+    for(; month < 12; month++)
+    {
+        monthDays = daysBeforeMonth[month] - daysBeforeMonth[month - 1];
+        if(month == 2 && (year % 4) == 0)
+            monthDays++;
+        if(days < monthDays)
+            break;
+        days -= monthDays;
+    }
+
+    value->Time.year = intToBcd(year);
+    value->Time.reserved = 0;
+    value->Time.month = intToBcd(month);
+    value->Time.day = intToBcd(days + 1);
+    value->Time.hours = intToBcd(seconds / 3600);
+    value->Time.minutes = intToBcd((seconds / 60) % 60);
+    value->Time.seconds = intToBcd(seconds % 60);
+}
+
+//=======================================================================================================================
+// Leitura do RTCC em segundos desde 01/01/1970. A conversão completa da data só é feita quando muda a hora; dentro da
+// mesma hora, soma-se minutos e segundos ao início da hora guardado.
+//=======================================================================================================================
+uint32_t readEpoch(void)
+{
+    DateTime_t now, check;
+    uint8_t minutes, seconds;
+
+    // Os registros são lidos um a um. Repete a leitura até duas seguidas coincidirem, para não misturar valores de
+    // antes e depois de uma virada de minuto ou hora.
+    readDateTime(&check);
+    do
+    {
+        now = check;
+        readDateTime(&check);
+    } while(memcmp(&now, &check, sizeof(DateTime_t)) != 0);
+
+    minutes = bcdToInt(now.Time.minutes);
+    seconds = bcdToInt(now.Time.seconds);
+
+    if(!hourCacheValid || memcmp(hourCacheWords, now.w, sizeof(hourCacheWords)) != 0)
+    {
+        memcpy(hourCacheWords, now.w, sizeof(hourCacheWords));
+        now.Time.minutes = 0;
+        now.Time.seconds = 0;
+        hourCacheEpoch = dateTimeToEpoch(&now);
+        hourCacheValid = 1;
+    }
+
+    return(hourCacheEpoch + ((uint16_t)minutes * 60) + seconds);
+}
+
+//=======================================================================================================================
+// Escrita do RTCC a partir de segundos desde 01/01/1970
+//=======================================================================================================================
+void writeEpoch(uint32_t epoch)
+{
+    DateTime_t value;
+
+    epochToDateTime(epoch, &value);
+    writeDateTime(&value);
 }
 
 //=======================================================================================================================
-// Converso de bcd para nmero inteiro
+// Conversão de bcd para número inteiro
 //=======================================================================================================================
 uint16_t bcdToInt(uint8_t data)
 {
@@ -158,7 +297,7 @@ uint16_t bcdToInt(uint8_t data)
 }
 
 //=======================================================================================================================
-// Converso de nmero inteiro para bcd
+// Conversão de número inteiro para bcd
 //=======================================================================================================================
 uint8_t intToBcd(uint16_t data)
 {
@@ -7,9 +7,29 @@
 #include <xc.h>
 
 //***********************************************************************************************************************
-// Tipos de variveis relacionadas ao mdulo de ADC
+// Definições
 //***********************************************************************************************************************
-// Varivel de data/hora
+#define EPOCH_2000      946684800UL     // 01/01/2000 00:00:00 em segundos desde 01/01/1970, início da contagem do RTCC
+#define EPOCH_2024      1704067200UL    // 01/01/2024 00:00:00, ano do desenvolvimento do projeto
+
+//***********************************************************************************************************************
+// Macros
+//***********************************************************************************************************************
+// Campos do horário a partir do epoch. O epoch começa à meia-noite, então basta o resto da divisão.
+#define epochSecondOfMinute(epoch)      ((uint8_t)((epoch) % 60))
+#define epochSecondOfHour(epoch)        ((uint16_t)((epoch) % 3600))
+#define epochSecondOfDay(epoch)         ((uint32_t)((epoch) % 86400UL))
+#define epochMinuteOfDay(epoch)         ((uint16_t)(epochSecondOfDay(epoch) / 60))
+
+// Prazos em epoch. A diferença com sinal continua correta mesmo que o prazo tenha sido calculado antes de um ajuste
+// do RTCC para trás.
+#define epochDelta(later, earlier)      ((int32_t)((uint32_t)(later) - (uint32_t)(earlier)))
+#define isEpochReached(now, deadline)   (epochDelta(now, deadline) >= 0)
+
+//***********************************************************************************************************************
+// Tipos de variáveis relacionadas ao módulo de ADC
+//***********************************************************************************************************************
+// Variável de data/hora
 typedef union
 {
     struct
@@ -28,16 +48,22 @@ typedef union
 } DateTime_t;
 
 //***********************************************************************************************************************
-// Funes pblicas do mdulo
+// Funções públicas do módulo
 //***********************************************************************************************************************
 extern void initRTCC(void);
 extern void writeDateTime(DateTime_t *value);
 extern void readDateTime(DateTime_t *value);
 extern void writeAlarmTime(DateTime_t *value);
+extern void writeSingleAlarm(DateTime_t *value);
 extern void readAlarmTime(DateTime_t *value);
 extern void setAlarmInterruptHandler(void (*handler)(void));
 extern void loraPowerDown(void);
 extern uint8_t isRTCCUpdated(void);
+extern void setRTCCCalibration(int8_t calibration);
+extern uint32_t dateTimeToEpoch(DateTime_t *value);
+extern void epochToDateTime(uint32_t epoch, DateTime_t *value);
+extern uint32_t readEpoch(void);
+extern void writeEpoch(uint32_t epoch);
 extern uint16_t bcdToInt(uint8_t data);
 extern uint8_t intToBcd(uint16_t data);
 
@@ -5,7 +5,7 @@
 #define	PERIPHERALS_SPI
 
 //=======================================================================================================================
-// Funes pblicas do mdulo
+// Funções públicas do módulo
 //=======================================================================================================================
 extern uint8_t SPITransfer(uint8_t data);
 extern void initSPI(void);
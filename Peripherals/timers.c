@@ -1,21 +1,21 @@
 //***********************************************************************************************************************
-//                                         Mdulo de Timers
+//                                         Módulo de Timers
 //***********************************************************************************************************************
 #include "../Configuration/HardwareConfiguration.h"
 #include "IOPorts.h"
 #include <xc.h>
 
 //***********************************************************************************************************************
-// Variveis privadas do mdulo
+// Variáveis privadas do módulo
 //***********************************************************************************************************************
 volatile uint32_t timer1Interrupts;
 
 //***********************************************************************************************************************
-// Interrupes
+// Interrupções
 //***********************************************************************************************************************
 //=======================================================================================================================
-// Interrupo do timer 1
-// Descrio: Sincronizao de tempo das vrias funes internas.
+// Interrupção do timer 1
+// Descrição: Sincronização de tempo das várias funções internas.
 //=======================================================================================================================
 void _ISR __attribute__((no_auto_psv)) _T1Interrupt(void)
 {
@@ -24,7 +24,7 @@ void _ISR __attribute__((no_auto_psv)) _T1Interrupt(void)
 }
 
 //***********************************************************************************************************************
-// Funes pblicas
+// Funções públicas
 //***********************************************************************************************************************
 //=======================================================================================================================
 // Liga ou desliga a contagem do timer
@@ -35,7 +35,7 @@ void setTimerState(uint8_t state)
 }
 
 //=======================================================================================================================
-// Verifica se o timer est ligado ou desligado
+// Verifica se o timer está ligado ou desligado
 //=======================================================================================================================
 uint8_t getTimerState(void)
 {
@@ -43,7 +43,7 @@ uint8_t getTimerState(void)
 }
 
 //=======================================================================================================================
-// L o marcador de tempo do timer. Retorno em milissegundos.
+// Lê o marcador de tempo do timer. Retorno em milissegundos.
 //=======================================================================================================================
 uint32_t getTimerInterruptCount(void)
 {
@@ -58,16 +58,39 @@ uint32_t getTimerInterruptCount(void)
 }
 
 //=======================================================================================================================
-// Inicializao de Timers
+// Lê o marcador de tempo em ciclos de instrução, para medir o custo de trechos de código. Cada contagem do Timer 1
+// vale 8 ciclos, e o contador dá a volta a cada 268 segundos (2^32 ciclos a 16 MHz).
+//=======================================================================================================================
+uint32_t getTimerCycleCount(void)
+{
+    uint32_t count;
+    uint16_t ticks;
+    uint8_t timerStatus;
+
+    timerStatus = _T1IE;
+    _T1IE = 0;
+    count = timer1Interrupts;
+    ticks = TMR1;
+    if(_T1IF)                   // Período completo, ainda não contado pela interrupção
+    {
+        count++;
+        ticks = TMR1;
+    }
+    _T1IE = timerStatus;
+    return(((count * (PR1 + 1)) + ticks) * 8);
+}
+
+//=======================================================================================================================
+// Inicialização de Timers
 //=======================================================================================================================
 void initTimers(void)
 {
     T1CON = 0x0000;
     TMR1 = 0x0000;
     PR1 = 0x07D0;       // Valor para contagem de 1ms
-    T1CON = 0x8010;     // Timer 1 On, Prescaler 1:8, clock interno = 500ns de perodo para 32MHz
-    _T1IE = 1;          // Habilita interrupo do Timer 1
-    _T1IP = 0x001;      // Prioridade mais baixa para a interrupo do Timer 1
+    T1CON = 0x8010;     // Timer 1 On, Prescaler 1:8, clock interno = 500ns de período para 32MHz
+    _T1IE = 1;          // Habilita interrupção do Timer 1
+    _T1IP = 0x001;      // Prioridade mais baixa para a interrupção do Timer 1
     
     timer1Interrupts = 0;
 }
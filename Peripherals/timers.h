@@ -5,17 +5,18 @@
 #define	PERIPHERALS_TIMERS
 
 //***********************************************************************************************************************
-// Definies
+// Definições
 //***********************************************************************************************************************
 #define TIMER_OFF            0
 #define TIMER_ON             1
 
 //***********************************************************************************************************************
-// Funes pblicas do mdulo
+// Funções públicas do módulo
 //***********************************************************************************************************************
 extern void setTimerState(uint8_t state);
 extern uint8_t getTimerState(void);
 extern uint32_t getTimerInterruptCount(void);
+extern uint32_t getTimerCycleCount(void);
 extern void initTimers(void);
 
 #endif
\ No newline at end of file
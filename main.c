@@ -2,7 +2,7 @@
 //                                 Estante Irrigada - Firmware de Controle
 //
 // Data:       16/08/2024
-// Descrio:  Ponto de entrada do projeto
+// Descrição:  Ponto de entrada do projeto
 //***********************************************************************************************************************
 
 // <editor-fold defaultstate="collapsed" desc="PIC24F16KA102 Configuration Bit Settings">
@@ -64,10 +64,16 @@
 #include "Peripherals/RTCC.h"
 #include "Applications/sensorHandling.h"
 #include "Applications/LoRaReception.h"
+#include "Applications/linkAdaptation.h"
+#include "Applications/sampleLog.h"
+#include "Applications/timeSync.h"
+#include "Applications/relay.h"
+#include "Applications/firmwareUpdate.h"
+#include "Applications/authentication.h"
 #include "Applications/mainApplication.h"
 
 //***********************************************************************************************************************
-// Variveis globais
+// Variáveis globais
 //***********************************************************************************************************************
 // <editor-fold defaultstate="collapsed" desc="Project pin configuration table">
 const IOPortSetup_t ioSetup[] =
@@ -118,16 +124,46 @@ controlConfig_t controlList[MAX_SENSORS] =
 // <editor-fold defaultstate="collapsed" desc="Non-volatile Configurations for saving">
 typedef struct
 {
-    uint16_t        operation[MAX_SENSORS];
-    uint16_t        minThreshold[MAX_SENSORS];
-    uint16_t        maxThreshold[MAX_SENSORS];
+    uint16_t            operation[MAX_SENSORS];
+    uint16_t            minThreshold[MAX_SENSORS];
+    uint16_t            maxThreshold[MAX_SENSORS];
+    uint16_t            deadband[MAX_SENSORS];
+    IrrigationWindow_t  window[MAX_SENSORS];
+    IrrigationWindow_t  blackout[MAX_SENSORS];
+    uint16_t            heartbeatMinutes;
+    uint16_t            summaryMinutes;
+    uint16_t            sampleMinutes;
+    LoRaModemConfig_t   modemConfig;
+    LoRaModemConfig_t   pendingModemConfig;
+    uint16_t            pendingModemTrials;
+    uint16_t            nodeAddress;
+    uint16_t            groupMembership;
+    UplinkSlot_t        uplinkSlot;
+    TimeSyncState_t     timeSync;
+    RelayConfig_t       relay;
 } nonVolatileConfig_t;
 
+typedef char configEEPROMSizeCheck[((CONFIG_EEPROM_ADDRESS + sizeof(nonVolatileConfig_t)) <= AUTH_EEPROM_ADDRESS) ? 1 : -1];
+
 nonVolatileConfig_t nonVolatileConfig = 
 {
     .operation = {0, 0, 0, 0, 0, 0},
     .minThreshold = {620, 620, 620, 620, 620, 620},
-    .maxThreshold = {860, 860, 860, 860, 860, 860}
+    .maxThreshold = {860, 860, 860, 860, 860, 860},
+    .deadband = {DEFAULT_DEADBAND, DEFAULT_DEADBAND, DEFAULT_DEADBAND, DEFAULT_DEADBAND, DEFAULT_DEADBAND, DEFAULT_DEADBAND},
+    .window = {{0, 1440}, {0, 1440}, {0, 1440}, {0, 1440}, {0, 1440}, {0, 1440}},     // O dia todo
+    .blackout = {{0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}},                   // Sem bloqueio
+    .heartbeatMinutes = DEFAULT_HEARTBEAT,
+    .summaryMinutes = DEFAULT_SUMMARY_PERIOD,
+    .sampleMinutes = DEFAULT_SAMPLE_PERIOD,
+    .modemConfig = {.spreadingFactor = 7, .bandwidth = LORA_BW_125K, .codingRate = 5, .txPower = 17, .preambleLength = 8, .channel = 0},
+    .pendingModemConfig = {.spreadingFactor = 7, .bandwidth = LORA_BW_125K, .codingRate = 5, .txPower = 17, .preambleLength = 8, .channel = 0},
+    .pendingModemTrials = 0,
+    .nodeAddress = 0,
+    .groupMembership = 0,
+    .uplinkSlot = {.index = 0, .lengthMs = 0},
+    .timeSync = {.lastSync = 0, .driftReference = 0, .driftError = 0, .calibration = 0, .openCorrection = 0},
+    .relay = {.role = RELAY_ROLE_LEAF, .parent = RELAY_ROUTER_ADDRESS, .hops = 1, .parentScore = RELAY_SCORE_NONE}
 };
 // </editor-fold>
 
@@ -136,36 +172,144 @@ uint8_t setupTaks = 1;
 uint8_t timeOutState = TIME_OUT_ENABLED;
 uint8_t valveActivated = 0, readSensors = 0, requestCalendar = 0;
 uint8_t requestMessages = 0, sendSamples = 0;
+uint8_t wokeFromDeepSleep = 0;
+uint8_t uplinkPending = 0, uplinkSamples = 0, multicastListening = 0;
+uint32_t uplinkTick = 0, uplinkDelay = 0, multicastTick = 0, multicastDuration = 0;
+LoRaModemConfig_t *activeModemConfig = &nonVolatileConfig.modemConfig;
 
 //***********************************************************************************************************************
-// Funes privadas que no podem ser acessadas por aplicaes-filho
+// Funções privadas que não podem ser acessadas por aplicações-filho
 //***********************************************************************************************************************
 //=======================================================================================================================
-// Configura a execuo das tasks
+// Indica se o minuto do dia tem a janela de escuta programada, alinhada aos beacons de horário
+//=======================================================================================================================
+static uint8_t isMulticastMinute(uint16_t minuteOfDay)
+{
+    return((minuteOfDay % (TIME_BEACON_INTERVAL / 60)) == 0);
+}
+
+//=======================================================================================================================
+// Configura a execução das tasks
 //=======================================================================================================================
 static void setupForTaskExecution(void)
 {
     if(setupTaks)
     {
-        DateTime_t now;
-        readDateTime(&now);
+        uint16_t second, slotOffset, elapsed;
+        uint32_t now;
 
-        requestCalendar = !isRTCCUpdated();
+        // O horário chega por beacon do roteador. O pedido direto fica para quando os beacons se perdem.
+        requestCalendar = isTimeRequestDue();
         readSensors = valveActivated;
-        if(!requestCalendar)
+        if(isRTCCUpdated())
         {
-            requestMessages = 1;
-            
-            if(bcdToInt(now.Time.seconds) < 10)
-                sendSamples = 1;
+            // As transmissões do despertar aguardam a janela de transmissão do módulo, no período de 10 segundos do
+            // alarme. As amostras só são enviadas no período que contém a janela.
+            now = readEpoch();
+            second = epochSecondOfMinute(now);
+            slotOffset = getUplinkSlotOffset();
+            elapsed = (second % 10) * 1000;
+            uplinkDelay = ((slotOffset % 10000) > elapsed) ? ((slotOffset % 10000) - elapsed) : 0;
+            uplinkSamples = ((second / 10) == (slotOffset / 10000));
+            uplinkTick = getTimerInterruptCount();
+            uplinkPending = 1;
+
+            // Na janela de escuta programada, o módulo só escuta: uma transmissão própria colidiria com os quadros
+            // do roteador para a rede toda.
+            if(isMulticastMinute(epochMinuteOfDay(now)) && second >= MULTICAST_WINDOW_SECOND &&
+               second < (MULTICAST_WINDOW_SECOND + MULTICAST_WINDOW_SECONDS))
+            {
+                multicastDuration = (uint32_t)(MULTICAST_WINDOW_SECOND + MULTICAST_WINDOW_SECONDS - second) * 1000;
+                multicastTick = uplinkTick;
+                multicastListening = 1;
+                uplinkPending = 0;
+            }
         }
         
         setupTaks = 0;
-    }    
+    }
+
+    if(uplinkPending)
+    {
+        if((getTimerInterruptCount() - uplinkTick) >= uplinkDelay)
+        {
+            requestMessages = 1;
+            sendSamples = uplinkSamples;
+            uplinkPending = 0;
+        }
+        resetTimeOut();
+    }
+
+    if(multicastListening)
+    {
+        if((getTimerInterruptCount() - multicastTick) >= multicastDuration)
+            multicastListening = 0;
+        else
+            resetTimeOut();
+    }
+}
+
+//=======================================================================================================================
+// Programa o alarme do próximo despertar para o próximo evento do calendário: a amostra do próximo minuto, dentro de
+// uma janela de irrigação, ou então o que vier primeiro entre o início de uma janela, a próxima leitura, o próximo
+// heartbeat, o fechamento do próximo resumo e a próxima janela de escuta programada. A cadência das leituras fora das janelas é a de getSampleInterval(), que
+// por padrão mantém uma leitura por minuto; aumentá-la economiza bateria, mas também atrasa os downlinks, que só são
+// ouvidos após um envio, e espaça as amostras das estatísticas do resumo. O alarme cai no segundo da janela de
+// transmissão do módulo; no minuto da escuta programada, o módulo acorda de novo em MULTICAST_WINDOW_SECOND para
+// receber beacons, comandos de grupo e blocos de OTA, que não seguem a transmissão de um módulo específico. Sem o RTCC
+// atualizado, ou com válvulas ligadas, mantém o alarme periódico de initRTCC(). Retorna o tempo até o despertar, em
+// segundos.
+//=======================================================================================================================
+static uint32_t scheduleNextWake(void)
+{
+    DateTime_t alarm;
+    uint16_t minuteOfDay, second, minutes, period, intervals[4], alarmSecond;
+    uint32_t now, wakeSecond;
+
+    if(!isRTCCUpdated() || valveActivated)
+        return WAKE_INTERVAL_SECONDS;
+
+    now = readEpoch();
+    minuteOfDay = epochMinuteOfDay(now);
+    second = epochSecondOfMinute(now);
+
+    minutes = getMinutesToIrrigationWindow(minuteOfDay);
+    if(minutes == 0)
+        minutes = 1;
+
+    // Leituras, heartbeat e resumo são alinhados ao minuto do dia
+    intervals[0] = getHeartbeatInterval();
+    intervals[1] = getSummaryInterval();
+    intervals[2] = getSampleInterval();
+    intervals[3] = TIME_BEACON_INTERVAL / 60;
+    for(uint8_t index = 0; index < 4; index++)
+    {
+        period = intervals[index];
+        if(period == 0 && index == 1)
+            continue;           // Resumos desabilitados
+        period = (period <= 1) ? 1 : (period - (minuteOfDay % period));
+        if(period < minutes)
+            minutes = period;
+    }
+
+    alarmSecond = getUplinkSlotOffset() / 1000;
+    if(isMulticastMinute(minuteOfDay) && second < MULTICAST_WINDOW_SECOND)
+    {
+        minutes = 0;
+        alarmSecond = MULTICAST_WINDOW_SECOND;
+    }
+
+    wakeSecond = ((uint32_t)(minuteOfDay + minutes) * 60) % 86400UL;
+    // O alarme diário compara apenas hora, minuto e segundo; a data de 01/01/2000 só preenche os demais registros
+    epochToDateTime(EPOCH_2000 + wakeSecond, &alarm);
+    alarm.Time.seconds = intToBcd(alarmSecond);
+    writeSingleAlarm(&alarm);
+
+    return(((uint32_t)minutes * 60) + alarmSecond - second);
 }
 
 //=======================================================================================================================
-// Vetor de interrupo do alarme
+// Vetor de interrupção do alarme
 //=======================================================================================================================
 static void alarmHandler(void)
 {
@@ -173,7 +317,7 @@ static void alarmHandler(void)
 }
 
 //=======================================================================================================================
-// Inicializao de pinos de IO
+// Inicialização de pinos de IO
 //=======================================================================================================================
 void initIOPins(void)
 {
@@ -181,76 +325,401 @@ void initIOPins(void)
     {
         RCONbits.DPSLP = 0;
         DSCONbits.RELEASE = 0;       // Libera os pinos para seu estado anterior ao Deep Sleep
+        wokeFromDeepSleep = 1;
     }
 
-    // Desliga todos os mdulos para reduzir o consumo
-    // Depois, liga-se apenas os necessrios.
+    // Desliga todos os módulos para reduzir o consumo
+    // Depois, liga-se apenas os necessários.
     PMD1 = 0xFFFF;
     PMD2 = 0xFFFF;
     PMD3 = 0xFFFF;
     PMD4 = 0xFFFF;
     
-    PMD1bits.SPI1MD = 0;         // Habilita o mdulo SPI para comunicao LoRa
+    PMD1bits.SPI1MD = 0;         // Habilita o módulo SPI para comunicação LoRa
     PMD1bits.ADC1MD = 0;         // Habilita o ADC
     PMD1bits.T1MD = 0;           // Habilita o Timer 1
     PMD3bits.RTCCMD = 0;         // Habilita o RTCC
     PMD4bits.EEMD = 0;           // Habilita a EEPROM
     
-    // Configurao dos pinos usados no projeto
+    // Configuração dos pinos usados no projeto
     setupPinList(ioSetup, sizeof(ioSetup)/sizeof(IOPortSetup_t));
-    // Configurao de conversores analgico-digital
+    // Configuração de conversores analógico-digital
     setupADCPinState(ADC_ALL, PIN_DIGITAL);
     setupADCPinStateList(adSetup, sizeof(adSetup)/sizeof(ADCSetup_t));
 }
 
 //=======================================================================================================================
-// Recupera as configuraes do mdulo
+// Salva apenas um campo da configuração não volátil
+//=======================================================================================================================
+static void saveConfigurationField(void *field, uint16_t size)
+{
+    saveToEEPROM((uint8_t *)field, CONFIG_EEPROM_ADDRESS + ((uint8_t *)field - (uint8_t *)&nonVolatileConfig), size);
+}
+
+//=======================================================================================================================
+// Copia a configuração de controle em uso para a configuração não volátil
+//=======================================================================================================================
+static void updateNonVolatileConfig(void)
+{
+    for(uint8_t index = 0; index < MAX_SENSORS; index++)
+    {
+        nonVolatileConfig.operation[index] = controlList[index].operation;
+        nonVolatileConfig.minThreshold[index] = controlList[index].minThreshold;
+        nonVolatileConfig.maxThreshold[index] = controlList[index].maxThreshold;
+        nonVolatileConfig.deadband[index] = controlList[index].deadband;
+        nonVolatileConfig.window[index] = controlList[index].window;
+        nonVolatileConfig.blackout[index] = controlList[index].blackout;
+    }
+}
+
+//=======================================================================================================================
+// Recupera as configurações do módulo
 //=======================================================================================================================
 void loadModuleConfiguration(void)
 {
-    loadFromEEPROM((uint8_t *)&nonVolatileConfig, 2, sizeof(nonVolatileConfig));
+    loadFromEEPROM((uint8_t *)&nonVolatileConfig, CONFIG_EEPROM_ADDRESS, sizeof(nonVolatileConfig));
     for(uint8_t index = 0; index < MAX_SENSORS; index++)
     {
         controlList[index].operation = (uint8_t)nonVolatileConfig.operation[index];
         controlList[index].minThreshold = nonVolatileConfig.minThreshold[index];
         controlList[index].maxThreshold = nonVolatileConfig.maxThreshold[index];
+        controlList[index].deadband = nonVolatileConfig.deadband[index];
+        controlList[index].window = nonVolatileConfig.window[index];
+        controlList[index].blackout = nonVolatileConfig.blackout[index];
         controlList[index].lastState = readPin(controlList[index].valvePin);
     }
+
+    // Uma configuração de modem nova fica em teste por alguns despertares. Se o roteador não for ouvido com ela
+    // neste período, o módulo volta para a última configuração confirmada.
+    if(nonVolatileConfig.pendingModemTrials > 0)
+    {
+        nonVolatileConfig.pendingModemTrials--;
+        saveConfigurationField(&nonVolatileConfig.pendingModemTrials, sizeof(uint16_t));
+        activeModemConfig = &nonVolatileConfig.pendingModemConfig;
+    }
+    else
+        activeModemConfig = &nonVolatileConfig.modemConfig;
 }
 
 //***********************************************************************************************************************
-// Funes pblicas que podem ser acessadas por aplicaes-filho
+// Funções públicas que podem ser acessadas por aplicações-filho
 //***********************************************************************************************************************
 //=======================================================================================================================
-// Salva as configuraes do projeto
+// Salva as configurações do projeto. As palavras alteradas entram na fila de gravação da EEPROM e são gravadas em
+// segundo plano, então o retorno é imediato.
 //=======================================================================================================================
 uint8_t saveConfiguration(void)
 {
-    for(uint8_t index = 0; index < MAX_SENSORS; index++)
-    {
-        nonVolatileConfig.operation[index] = controlList[index].operation;
-        nonVolatileConfig.minThreshold[index] = controlList[index].minThreshold;
-        nonVolatileConfig.maxThreshold[index] = controlList[index].maxThreshold;
-    }
+    updateNonVolatileConfig();
     
-    if(saveToEEPROM((uint8_t *)&nonVolatileConfig, 2, sizeof(nonVolatileConfig)) == sizeof(nonVolatileConfig))
+    if(saveToEEPROM((uint8_t *)&nonVolatileConfig, CONFIG_EEPROM_ADDRESS, sizeof(nonVolatileConfig)) == sizeof(nonVolatileConfig))
         return 1;
     else
         return 0;
 }
 
 //=======================================================================================================================
-// Coloca o dispositivo em modo Deep Sleep para consumo mnimo de energia
+// CRC16-CCITT (polinômio 0x1021), continuando a partir de crc
+//=======================================================================================================================
+uint16_t updateCRC16(uint16_t crc, uint8_t *data, uint16_t size)
+{
+    while(size--)
+    {
+        crc ^= (uint16_t)(*data++) << 8;
+        for(uint8_t bit = 0; bit < 8; bit++)
+            crc = (crc & 0x8000) ? ((crc << 1) ^ 0x1021) : (crc << 1);
+    }
+    return crc;
+}
+
+//=======================================================================================================================
+// Continua o CRC16-CCITT com um valor de 16 bits, byte menos significativo primeiro
+//=======================================================================================================================
+static uint16_t updateCRC16Word(uint16_t crc, uint16_t value)
+{
+    uint8_t bytes[2] = {(uint8_t)value, (uint8_t)(value >> 8)};
+
+    return updateCRC16(crc, bytes, sizeof(bytes));
+}
+
+//=======================================================================================================================
+// Resumo da configuração definida pelo roteador, enviado em cada CMD_REQUEST_ACTION. CRC16-CCITT, com valor
+// inicial 0xFFFF, de uma lista de campos serializada, que não depende do alinhamento das estruturas na memória:
+//   - operation, minThreshold, maxThreshold e deadband dos 6 canais, cada lista completa antes da seguinte;
+//   - window e blackout dos 6 canais, como início e fim;
+//   - heartbeatMinutes, summaryMinutes e sampleMinutes;
+//   - modemConfig: spreadingFactor, bandwidth, codingRate e txPower em um byte cada, preambleLength e channel;
+//   - nodeAddress e groupMembership.
+// Campos de 16 bits vão com o byte menos significativo primeiro; os de 8 bits, em um byte. Estado interno, como a
+// configuração de modem em teste e o sincronismo de horário, fica de fora.
+//=======================================================================================================================
+uint16_t getConfigurationHash(void)
+{
+    uint16_t crc = 0xFFFF;
+    LoRaModemConfig_t *modem = &nonVolatileConfig.modemConfig;
+    uint8_t modemBytes[4] = {modem->spreadingFactor, modem->bandwidth, modem->codingRate, (uint8_t)modem->txPower};
+
+    updateNonVolatileConfig();
+    for(uint8_t index = 0; index < MAX_SENSORS; index++)
+        crc = updateCRC16Word(crc, nonVolatileConfig.operation[index]);
+    for(uint8_t index = 0; index < MAX_SENSORS; index++)
+        crc = updateCRC16Word(crc, nonVolatileConfig.minThreshold[index]);
+    for(uint8_t index = 0; index < MAX_SENSORS; index++)
+        crc = updateCRC16Word(crc, nonVolatileConfig.maxThreshold[index]);
+    for(uint8_t index = 0; index < MAX_SENSORS; index++)
+        crc = updateCRC16Word(crc, nonVolatileConfig.deadband[index]);
+    for(uint8_t index = 0; index < MAX_SENSORS; index++)
+    {
+        crc = updateCRC16Word(crc, nonVolatileConfig.window[index].start);
+        crc = updateCRC16Word(crc, nonVolatileConfig.window[index].end);
+    }
+    for(uint8_t index = 0; index < MAX_SENSORS; index++)
+    {
+        crc = updateCRC16Word(crc, nonVolatileConfig.blackout[index].start);
+        crc = updateCRC16Word(crc, nonVolatileConfig.blackout[index].end);
+    }
+    crc = updateCRC16Word(crc, nonVolatileConfig.heartbeatMinutes);
+    crc = updateCRC16Word(crc, nonVolatileConfig.summaryMinutes);
+    crc = updateCRC16Word(crc, nonVolatileConfig.sampleMinutes);
+
+    crc = updateCRC16(crc, modemBytes, sizeof(modemBytes));
+    crc = updateCRC16Word(crc, modem->preambleLength);
+    crc = updateCRC16(crc, &modem->channel, sizeof(uint8_t));
+
+    crc = updateCRC16Word(crc, nonVolatileConfig.nodeAddress);
+    return updateCRC16Word(crc, nonVolatileConfig.groupMembership);
+}
+
+//=======================================================================================================================
+// Coloca uma nova configuração de modem em teste. Ela só é aplicada pelo chamador, depois de confirmar o comando
+// com a configuração antiga.
+//=======================================================================================================================
+uint8_t setModemConfiguration(LoRaModemConfig_t *config)
+{
+    if(!isLoRaModemConfigValid(config))
+        return 0;
+
+    nonVolatileConfig.pendingModemConfig = *config;
+    nonVolatileConfig.pendingModemTrials = MODEM_CONFIG_TRIALS;
+    saveConfigurationField(&nonVolatileConfig.pendingModemConfig, sizeof(LoRaModemConfig_t));
+    saveConfigurationField(&nonVolatileConfig.pendingModemTrials, sizeof(uint16_t));
+    activeModemConfig = &nonVolatileConfig.pendingModemConfig;
+    return 1;
+}
+
+//=======================================================================================================================
+// Confirma a configuração de modem em teste, pois o roteador foi ouvido com ela
+//=======================================================================================================================
+void confirmModemConfiguration(void)
+{
+    if(activeModemConfig == &nonVolatileConfig.pendingModemConfig)
+    {
+        nonVolatileConfig.modemConfig = nonVolatileConfig.pendingModemConfig;
+        nonVolatileConfig.pendingModemTrials = 0;
+        saveConfigurationField(&nonVolatileConfig.modemConfig, sizeof(LoRaModemConfig_t));
+        saveConfigurationField(&nonVolatileConfig.pendingModemTrials, sizeof(uint16_t));
+        activeModemConfig = &nonVolatileConfig.modemConfig;
+    }
+}
+
+//=======================================================================================================================
+// Grava diretamente uma nova configuração de modem, sem período de teste. Usado quando a configuração atual já
+// se mostrou incapaz de alcançar o roteador. Passa a valer no próximo despertar.
+//=======================================================================================================================
+void commitModemConfiguration(LoRaModemConfig_t *config)
+{
+    if(!isLoRaModemConfigValid(config))
+        return;
+
+    nonVolatileConfig.modemConfig = *config;
+    saveConfigurationField(&nonVolatileConfig.modemConfig, sizeof(LoRaModemConfig_t));
+}
+
+//=======================================================================================================================
+// Retorna a configuração de modem em uso
+//=======================================================================================================================
+LoRaModemConfig_t *getModemConfiguration(void)
+{
+    return activeModemConfig;
+}
+
+//=======================================================================================================================
+// Indica se a configuração de modem em uso ainda está em teste
+//=======================================================================================================================
+uint8_t isModemConfigurationOnTrial(void)
+{
+    return(activeModemConfig == &nonVolatileConfig.pendingModemConfig);
+}
+
+//=======================================================================================================================
+// Intervalo máximo entre envios de amostras, em minutos
+//=======================================================================================================================
+uint16_t getHeartbeatInterval(void)
+{
+    return nonVolatileConfig.heartbeatMinutes;
+}
+
+//=======================================================================================================================
+// Define o intervalo máximo entre envios de amostras. Assim como as demais configurações de controle, só é gravado
+// na EEPROM com saveConfiguration().
+//=======================================================================================================================
+void setHeartbeatInterval(uint16_t minutes)
+{
+    nonVolatileConfig.heartbeatMinutes = minutes;
+}
+
+//=======================================================================================================================
+// Período do resumo de estatísticas, em minutos
+//=======================================================================================================================
+uint16_t getSummaryInterval(void)
+{
+    return nonVolatileConfig.summaryMinutes;
+}
+
+//=======================================================================================================================
+// Define o período do resumo de estatísticas. Só é gravado na EEPROM com saveConfiguration().
+//=======================================================================================================================
+void setSummaryInterval(uint16_t minutes)
+{
+    nonVolatileConfig.summaryMinutes = minutes;
+}
+
+//=======================================================================================================================
+// Intervalo entre leituras fora das janelas de irrigação, em minutos
+//=======================================================================================================================
+uint16_t getSampleInterval(void)
+{
+    return nonVolatileConfig.sampleMinutes;
+}
+
+//=======================================================================================================================
+// Define o intervalo entre leituras fora das janelas de irrigação. Só é gravado na EEPROM com saveConfiguration().
+//=======================================================================================================================
+void setSampleInterval(uint16_t minutes)
+{
+    nonVolatileConfig.sampleMinutes = minutes;
+}
+
+//=======================================================================================================================
+// Endereço do módulo na rede
+//=======================================================================================================================
+uint8_t getNodeAddress(void)
+{
+    return (uint8_t)nonVolatileConfig.nodeAddress;
+}
+
+//=======================================================================================================================
+// Define e salva o endereço do módulo na rede
+//=======================================================================================================================
+void setNodeAddress(uint8_t address)
+{
+    nonVolatileConfig.nodeAddress = address;
+    saveConfigurationField(&nonVolatileConfig.nodeAddress, sizeof(uint16_t));
+}
+
+//=======================================================================================================================
+// Grupos de endereçamento dos quais o módulo é membro, um por bit
+//=======================================================================================================================
+uint16_t getGroupMembership(void)
+{
+    return nonVolatileConfig.groupMembership;
+}
+
+//=======================================================================================================================
+// Define e salva os grupos de endereçamento do módulo
+//=======================================================================================================================
+void setGroupMembership(uint16_t groups)
+{
+    nonVolatileConfig.groupMembership = groups;
+    saveConfigurationField(&nonVolatileConfig.groupMembership, sizeof(uint16_t));
+}
+
+//=======================================================================================================================
+// Janela de transmissão atribuída pelo roteador
+//=======================================================================================================================
+UplinkSlot_t *getUplinkSlot(void)
+{
+    return &nonVolatileConfig.uplinkSlot;
+}
+
+//=======================================================================================================================
+// Define e salva a janela de transmissão do módulo
+//=======================================================================================================================
+void setUplinkSlot(UplinkSlot_t *slot)
+{
+    nonVolatileConfig.uplinkSlot = *slot;
+    saveConfigurationField(&nonVolatileConfig.uplinkSlot, sizeof(UplinkSlot_t));
+}
+
+//=======================================================================================================================
+// Estado do sincronismo de horário
+//=======================================================================================================================
+TimeSyncState_t *getTimeSyncState(void)
+{
+    return &nonVolatileConfig.timeSync;
+}
+
+//=======================================================================================================================
+// Define e salva o estado do sincronismo de horário
+//=======================================================================================================================
+void saveTimeSyncState(TimeSyncState_t *state)
+{
+    nonVolatileConfig.timeSync = *state;
+    saveConfigurationField(&nonVolatileConfig.timeSync, sizeof(TimeSyncState_t));
+}
+
+//=======================================================================================================================
+// Papel do módulo no encaminhamento e pai escolhido
+//=======================================================================================================================
+RelayConfig_t *getRelayConfig(void)
+{
+    return &nonVolatileConfig.relay;
+}
+
+//=======================================================================================================================
+// Define e salva o papel do módulo no encaminhamento e o pai escolhido
+//=======================================================================================================================
+void saveRelayConfig(RelayConfig_t *config)
+{
+    nonVolatileConfig.relay = *config;
+    saveConfigurationField(&nonVolatileConfig.relay, sizeof(RelayConfig_t));
+}
+
+//=======================================================================================================================
+// Coloca o dispositivo em modo Deep Sleep para consumo mínimo de energia
 //=======================================================================================================================
 void deepSleep(void)
 {
+    uint32_t sleepSeconds;
+
+    flushTransmitQueue();   // O rádio é desligado em seguida
+    finishSampleCycle();
+    finishRelayCycle();     // Antes de finishLinkCycle(), que atualiza a contagem de despertares sem o roteador
+    finishLinkCycle();
+
+    // O crédito de tempo no ar é reposto pelo intervalo que o módulo passará dormindo, e preservado para o próximo
+    // despertar.
+    sleepSeconds = scheduleNextWake();
+    creditLoRaAirtime((sleepSeconds > AIRTIME_WINDOW_SECONDS) ? AIRTIME_WINDOW_SECONDS : (uint16_t)sleepSeconds);
+    setRetainedAirtimeCredit(getLoRaAirtimeCredit() / 10);
+
+    eepromFlush();      // A fila de gravação da EEPROM está na RAM, que é perdida no Deep Sleep
     loraPowerDown();
     DSCONbits.DSEN = 1; // Define o modo Deep Sleep
     Sleep();
 }
 
 //=======================================================================================================================
-// Fora o setup das tarefas, para o caso de atualizao de RTCC
+// Indica se o módulo está na janela de escuta programada, quando deve continuar ouvindo depois das próprias janelas
+// de recepção
+//=======================================================================================================================
+uint8_t isMulticastListening(void)
+{
+    return multicastListening;
+}
+
+//=======================================================================================================================
+// Força o setup das tarefas, para o caso de atualização de RTCC
 //=======================================================================================================================
 void forceTaskSetup(void)
 {
@@ -258,7 +727,7 @@ void forceTaskSetup(void)
 }
 
 //=======================================================================================================================
-// Reseta o timeout da aplicao. Quando chega ao final do timeout, a aplicao entra em modo Deep Sleep
+// Reseta o timeout da aplicação. Quando chega ao final do timeout, a aplicação entra em modo Deep Sleep
 //=======================================================================================================================
 void resetTimeOut(void)
 {
@@ -266,33 +735,49 @@ void resetTimeOut(void)
 }
 
 //=======================================================================================================================
-// Reseta o timeout da aplicao. Quando chega ao final do timeout, a aplicao entra em modo Deep Sleep
+// Reseta o timeout da aplicação. Quando chega ao final do timeout, a aplicação entra em modo Deep Sleep
 //=======================================================================================================================
 void setTimeOutState(uint8_t state)
 {
     timeOutState = state;
 }
 
+//=======================================================================================================================
+// Estado do timeout da aplicação
+//=======================================================================================================================
+uint8_t getTimeOutState(void)
+{
+    return timeOutState;
+}
+
 //***********************************************************************************************************************
-// Funo principal
+// Função principal
 //***********************************************************************************************************************
 int main(void) 
 {
     uint8_t valveActivationLastState;
     
-    // Inicializao do sistema
+    // Inicialização do sistema
     initIOPins();
     initTimers();
     initADCs();
     
     initEEPROM((uint8_t *)&nonVolatileConfig, sizeof(nonVolatileConfig));
     loadModuleConfiguration();
+    initSampleLog();
+    initFirmwareUpdate();
+    initAuthentication(!wokeFromDeepSleep);
     
     setAlarmInterruptHandler(alarmHandler);
     initRTCC();
+    initTimeSync(!wokeFromDeepSleep);
     
     initSPI();
     initLoRa(LORA_RST, LORA_NSS);
+    setLoRaModemConfig(activeModemConfig);
+    // Após um Power-on Reset não há histórico de transmissões, e o crédito começa cheio.
+    if(wokeFromDeepSleep)
+        setLoRaAirtimeCredit(getRetainedAirtimeCredit() * 10);
 
     initTaskSensorHandling(LED, SENSOR_EN);
     
@@ -306,16 +791,18 @@ int main(void)
         setupForTaskExecution();
         taskSensorHandling(&sendSamples, &readSensors, &valveActivated);
         taskLoRaReception(&requestCalendar, &requestMessages);
+        taskRelay();
         
-        // Sem vlvulas ativas, o sistema pode operar no modo de power-down
-        if(valveActivated == 0)
+        // Sem válvulas ativas, o sistema pode operar no modo de power-down. Relays permanecem acordados, e uma leitura
+        // de sensores em andamento termina antes.
+        if(valveActivated == 0 && !isRelayNode() && !isSensorHandlingBusy())
         {
-            // Inicia o timeout assim que desativar todas as vlvulas
+            // Inicia o timeout assim que desativar todas as válvulas
             if(valveActivationLastState == 1)
                 resetTimeOut();
         
-            // O firmware deve entrar em modo Deep Sleep quando no houver vlvulas ligadas. Isto porque
-            // no Deep Sleep as portas do microcontrolador so desligadas.
+            // O firmware deve entrar em modo Deep Sleep quando não houver válvulas ligadas. Isto porque
+            // no Deep Sleep as portas do microcontrolador são desligadas.
             if(timeOutState == FORCE_TIMEOUT)
                 deepSleep();
             else if(timeOutState == TIME_OUT_ENABLED)